@@ -0,0 +1,283 @@
+//
+//  AsyncLogger.h
+//  LunaticoBeaver X2 plugin
+//
+//  Debug log writer that keeps file I/O off the caller's thread.
+//  Each "logger << a << b << std::endl;" statement formats into a stack buffer and is
+//  pushed as one line into a bounded lock-free ring (multiple producers, one consumer).
+//  A background thread drains the ring in batches and rotates the file when it gets too big.
+//  If the ring is full the line is dropped and counted, the caller never blocks.
+
+#ifndef __AsyncLogger__
+#define __AsyncLogger__
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <ostream>
+#include <streambuf>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define ASYNC_LOG_LINE_SIZE         512
+#define ASYNC_LOG_RING_SIZE         2048            // lines, must be a power of 2
+#define ASYNC_LOG_WRITE_INTERVAL    50              // ms between writer wake ups, sooner if the ring is half full
+#define ASYNC_LOG_MAX_FILE_SIZE     (8*1024*1024)   // bytes before rotation
+#define ASYNC_LOG_MAX_FILES         3               // Log.txt, Log.txt.1, Log.txt.2
+
+class CAsyncLogger;
+
+// fixed size, allocation free, stream buffer for one line. Overlong lines are truncated.
+class CLogLineBuf : public std::streambuf
+{
+public:
+    CLogLineBuf() { setp(m_szLine, m_szLine + ASYNC_LOG_LINE_SIZE - 1); }
+
+    void assign(const CLogLineBuf &Other)
+    {
+        size_t nLen = Other.length();
+        memcpy(m_szLine, Other.m_szLine, nLen);
+        setp(m_szLine, m_szLine + ASYNC_LOG_LINE_SIZE - 1);
+        pbump(int(nLen));
+    }
+
+    // make sure the line ends with a new line, there is always room left for it.
+    void terminate()
+    {
+        if(length() && *(pptr() - 1) != '\n') {
+            *pptr() = '\n';
+            pbump(1);
+        }
+    }
+
+    const char *data() const   { return m_szLine; }
+    size_t      length() const { return size_t(pptr() - pbase()); }
+
+protected:
+    virtual int_type overflow(int_type) { return traits_type::eof(); }
+
+    char m_szLine[ASYNC_LOG_LINE_SIZE];
+};
+
+// One log statement. It is handed to the logger when the temporary is destroyed,
+// at the end of the full expression.
+class CLogLine
+{
+public:
+    explicit CLogLine(CAsyncLogger *pLogger) : m_pLogger(pLogger), m_Stream(&m_Buf) { }
+
+    CLogLine(CLogLine &&Other) : m_pLogger(Other.m_pLogger), m_Stream(&m_Buf)
+    {
+        m_Buf.assign(Other.m_Buf);
+        m_Stream.flags(Other.m_Stream.flags());
+        m_Stream.precision(Other.m_Stream.precision());
+        Other.m_pLogger = NULL;
+    }
+
+    inline ~CLogLine();
+
+    template <typename T> CLogLine &operator<<(const T &Value) { m_Stream << Value; return *this; }
+    CLogLine &operator<<(std::ostream &(*pManip)(std::ostream &)) { pManip(m_Stream); return *this; }
+    CLogLine &operator<<(std::ios_base &(*pManip)(std::ios_base &)) { pManip(m_Stream); return *this; }
+
+private:
+    CLogLine(const CLogLine &);
+    CLogLine &operator=(const CLogLine &);
+
+    CAsyncLogger    *m_pLogger;
+    CLogLineBuf     m_Buf;
+    std::ostream    m_Stream;
+};
+
+class CAsyncLogger
+{
+public:
+    CAsyncLogger() : m_pFile(NULL), m_pSlots(NULL), m_nEnqueuePos(0), m_nDequeuePos(0), m_nDropped(0), m_nFileSize(0), m_bRunning(false) { }
+    ~CAsyncLogger() { close(); }
+
+    bool open(const std::string &sPath)
+    {
+        close();
+        m_sPath = sPath;
+        m_pFile = fopen(m_sPath.c_str(), "w");
+        if(!m_pFile)
+            return false;
+        m_nFileSize = 0;
+
+        m_pSlots = new LogSlot[ASYNC_LOG_RING_SIZE];
+        for(size_t i = 0; i < ASYNC_LOG_RING_SIZE; i++)
+            m_pSlots[i].nSeq.store(i, std::memory_order_relaxed);
+        m_nEnqueuePos.store(0, std::memory_order_relaxed);
+        m_nDequeuePos.store(0, std::memory_order_relaxed);
+        m_nDropped = 0;
+
+        m_bRunning = true;
+        m_WriterThread = std::thread(&CAsyncLogger::writer, this);
+        return true;
+    }
+
+    void close()
+    {
+        if(!m_pSlots)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_WriterMutex);
+            m_bRunning = false;
+        }
+        m_WriterWakeup.notify_all();
+        if(m_WriterThread.joinable())
+            m_WriterThread.join();
+        drain();
+        if(m_pFile)
+            fclose(m_pFile);
+        m_pFile = NULL;
+        delete [] m_pSlots;
+        m_pSlots = NULL;
+    }
+
+    bool is_open() const { return m_pSlots != NULL; }
+
+    // lines are written by the background thread, this only wakes it up.
+    void flush() { m_WriterWakeup.notify_all(); }
+
+    unsigned long dropped() const { return m_nDropped; }
+
+    template <typename T> CLogLine operator<<(const T &Value)
+    {
+        CLogLine Line(this);
+        Line << Value;
+        return Line;
+    }
+
+    // called by CLogLine, never blocks.
+    void push(const char *pszLine, size_t nLen)
+    {
+        LogSlot *pSlot;
+        size_t nPos;
+        intptr_t nDiff;
+
+        if(!m_pSlots || !nLen)
+            return;
+
+        nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+        for(;;) {
+            pSlot = &m_pSlots[nPos & (ASYNC_LOG_RING_SIZE - 1)];
+            nDiff = intptr_t(pSlot->nSeq.load(std::memory_order_acquire)) - intptr_t(nPos);
+            if(nDiff == 0) {
+                if(m_nEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(nDiff < 0) { // full
+                m_nDropped++;
+                return;
+            }
+            else
+                nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+        }
+
+        memcpy(pSlot->szLine, pszLine, nLen);
+        pSlot->nLen = nLen;
+        pSlot->nSeq.store(nPos + 1, std::memory_order_release);
+
+        // burst of lines, don't wait for the writer's next wake up
+        if(nPos - m_nDequeuePos.load(std::memory_order_relaxed) == ASYNC_LOG_RING_SIZE/2)
+            m_WriterWakeup.notify_one();
+    }
+
+protected:
+    struct LogSlot {
+        std::atomic<size_t> nSeq;
+        size_t              nLen;
+        char                szLine[ASYNC_LOG_LINE_SIZE];
+    };
+
+    void writer()
+    {
+        while(true) {
+            drain();
+            std::unique_lock<std::mutex> lock(m_WriterMutex);
+            if(!m_bRunning)
+                break;
+            m_WriterWakeup.wait_for(lock, std::chrono::milliseconds(ASYNC_LOG_WRITE_INTERVAL));
+        }
+    }
+
+    // single consumer : the writer thread, or close() once the writer is gone.
+    void drain()
+    {
+        LogSlot *pSlot;
+        size_t nPos;
+        unsigned long nDropped;
+        bool bWritten = false;
+
+        while(true) {
+            nPos = m_nDequeuePos.load(std::memory_order_relaxed);
+            pSlot = &m_pSlots[nPos & (ASYNC_LOG_RING_SIZE - 1)];
+            if(pSlot->nSeq.load(std::memory_order_acquire) != nPos + 1)
+                break;
+            if(m_pFile) {
+                fwrite(pSlot->szLine, 1, pSlot->nLen, m_pFile);
+                m_nFileSize += pSlot->nLen;
+            }
+            pSlot->nSeq.store(nPos + ASYNC_LOG_RING_SIZE, std::memory_order_release);
+            m_nDequeuePos.store(nPos + 1, std::memory_order_relaxed);
+            bWritten = true;
+        }
+
+        nDropped = m_nDropped.exchange(0);
+        if(nDropped && m_pFile) {
+            m_nFileSize += fprintf(m_pFile, "[AsyncLogger] %lu lines dropped, log ring full\n", nDropped);
+            bWritten = true;
+        }
+
+        if(!bWritten || !m_pFile)
+            return;
+        fflush(m_pFile);
+        if(m_nFileSize > ASYNC_LOG_MAX_FILE_SIZE)
+            rotate();
+    }
+
+    void rotate()
+    {
+        std::string sFrom;
+        std::string sTo;
+
+        fclose(m_pFile);
+        for(int i = ASYNC_LOG_MAX_FILES - 1; i > 0; i--) {
+            sFrom = (i == 1) ? m_sPath : m_sPath + "." + std::to_string(i - 1);
+            sTo = m_sPath + "." + std::to_string(i);
+            remove(sTo.c_str());
+            rename(sFrom.c_str(), sTo.c_str());
+        }
+        // if this fails the lines are discarded, logging must not take the driver down
+        m_pFile = fopen(m_sPath.c_str(), "w");
+        m_nFileSize = 0;
+    }
+
+    std::string                 m_sPath;
+    FILE                        *m_pFile;
+    LogSlot                     *m_pSlots;
+    std::atomic<size_t>         m_nEnqueuePos;
+    std::atomic<size_t>         m_nDequeuePos;  // only written by the consumer
+    std::atomic<unsigned long>  m_nDropped;
+    size_t                      m_nFileSize;
+
+    std::thread                 m_WriterThread;
+    std::mutex                  m_WriterMutex;
+    std::condition_variable     m_WriterWakeup;
+    bool                        m_bRunning;
+};
+
+CLogLine::~CLogLine()
+{
+    if(m_pLogger) {
+        m_Buf.terminate();
+        m_pLogger->push(m_Buf.data(), m_Buf.length());
+    }
+}
+
+#endif
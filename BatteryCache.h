@@ -0,0 +1,99 @@
+//
+//  BatteryCache.h
+//  LunaticoBeaver X2 plugin
+//
+//  Last shutter battery readings. Both go through the wireless shutter link, which
+//  can take seconds when the link is marginal, so they are read in the background
+//  and the callers get the cached values. The voltage ages, the cutoff only changes
+//  when we set it, so it is kept until Invalidate.
+//  Thread safe, the status poller refreshes it while the commands read it.
+
+#ifndef __BatteryCache__
+#define __BatteryCache__
+
+#include <mutex>
+
+#define BATTERY_REFRESH_INTERVAL    60000   // ms between background voltage reads
+#define BATTERY_MAX_AGE             300000  // ms, older voltages are read again before they are used
+#define BATTERY_OPEN_MAX_AGE        120000  // ms, how recent the voltage has to be to open the shutter
+#define BATTERY_MIN_CUTOFF          1.0     // V, anything lower is a bad read from the shutter
+
+class CBatteryCache
+{
+public:
+    CBatteryCache() : m_nCutOffGeneration(0) { Reset(); }
+
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_dVolts = 0;
+        m_nVoltsTime = 0;
+        m_dCutOff = 0;
+        m_bHasCutOff = false;
+        m_nCutOffGeneration++;
+    }
+
+    // nTime in ns, when the voltage was read
+    void SetVolts(double dVolts, long long nTime)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_dVolts = dVolts;
+        m_nVoltsTime = nTime;
+    }
+
+    // nGeneration from GetCutOffGeneration before the read, a read that raced with
+    // an Invalidate is dropped. So is a bad read, the next refresh asks again.
+    void SetCutOff(double dCutOff, unsigned int nGeneration)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(nGeneration != m_nCutOffGeneration || dCutOff < BATTERY_MIN_CUTOFF)
+            return;
+        m_dCutOff = dCutOff;
+        m_bHasCutOff = true;
+    }
+
+    // the cutoff was changed on the shutter
+    void InvalidateCutOff()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bHasCutOff = false;
+        m_nCutOffGeneration++;
+    }
+
+    unsigned int GetCutOffGeneration()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_nCutOffGeneration;
+    }
+
+    bool HasVolts(long long nNow, int nMaxAge)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_nVoltsTime && nNow - m_nVoltsTime <= nMaxAge * 1000000LL;
+    }
+
+    bool HasCutOff()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_bHasCutOff;
+    }
+
+    // false if a value is missing or the voltage is older than nMaxAge ms, the values are filled in anyway
+    bool Get(double &dVolts, double &dCutOff, long long nNow, int nMaxAge)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        dVolts = m_dVolts;
+        dCutOff = m_dCutOff;
+        return m_bHasCutOff && m_nVoltsTime && nNow - m_nVoltsTime <= nMaxAge * 1000000LL;
+    }
+
+protected:
+    std::mutex      m_Mutex;
+    double          m_dVolts;
+    long long       m_nVoltsTime;   // ns, 0 if never read
+    double          m_dCutOff;
+    bool            m_bHasCutOff;
+    unsigned int    m_nCutOffGeneration;    // bumped by Reset and InvalidateCutOff
+};
+
+#endif
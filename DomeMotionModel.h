@@ -0,0 +1,269 @@
+//
+//  DomeMotionModel.h
+//  LunaticoBeaver X2 plugin
+//
+//  Estimates the dome azimuth between serial samples.
+//  During a goto the dome follows a trapezoidal speed profile (accelerate to max speed, cruise,
+//  decelerate to min speed) on the shortest path to the target. Every new sample restarts the
+//  profile from the measured position and speed, so the error never accumulates past one poll.
+//  Without a known target or speed profile, the last measured speed is extrapolated for a short time.
+//  Not thread safe, the caller locks.
+
+#ifndef __DomeMotionModel__
+#define __DomeMotionModel__
+
+#include <math.h>
+
+#define MOTION_MAX_HORIZON  2000000000LL    // ns, don't extrapolate further than this past the last sample
+#define MOTION_MIN_SAMPLE_DT 20000000LL     // ns, closer samples are too noisy to estimate a speed
+
+class CDomeMotionModel
+{
+public:
+    CDomeMotionModel() { Reset(); }
+
+    void Reset()
+    {
+        m_dMinSpeed = 0;
+        m_dMaxSpeed = 0;
+        m_dAccel = 0;
+        m_dAz = 0;
+        m_dSpeed = 0;
+        m_nTime = 0;
+        m_bMoving = false;
+        m_bHasTarget = false;
+        m_dTargetAz = 0;
+    }
+
+    // speeds in degree/s, acceleration in degree/s^2. 0 when unknown.
+    void SetProfile(double dMinSpeed, double dMaxSpeed, double dAccel)
+    {
+        m_dMinSpeed = dMinSpeed > 0 ? dMinSpeed : 0;
+        m_dMaxSpeed = dMaxSpeed > m_dMinSpeed ? dMaxSpeed : m_dMinSpeed;
+        m_dAccel = dAccel > 0 ? dAccel : 0;
+    }
+
+    bool HasProfile() const { return m_dMaxSpeed > 0; }
+    double GetMaxSpeed() const { return m_dMaxSpeed; }
+
+    // measured position. The speed is re-estimated from the previous sample while moving.
+    void AddSample(double dAz, long long nTime, bool bMoving)
+    {
+        double dSpeed;
+
+        if(m_nTime && nTime <= m_nTime)
+            return; // out of order
+
+        if(bMoving && m_bMoving && m_nTime && nTime - m_nTime >= MOTION_MIN_SAMPLE_DT) {
+            dSpeed = fabs(AngleDiff(m_dAz, dAz)) / (double(nTime - m_nTime) * 1e-9);
+            // a sample around a reversal or a sync would give a silly speed
+            if(!HasProfile() || dSpeed <= m_dMaxSpeed * 1.5)
+                m_dSpeed = dSpeed;
+        }
+        else if(!bMoving)
+            m_dSpeed = 0;
+
+        m_dAz = Normalize(dAz);
+        m_nTime = nTime;
+        m_bMoving = bMoving;
+        if(!bMoving)
+            m_bHasTarget = false;
+    }
+
+    // the dome was told to go to dTargetAz at nTime, it starts from rest if it wasn't moving.
+    void SetTarget(double dTargetAz, long long nTime)
+    {
+        if(!m_nTime)
+            return; // we don't know where we start from
+        if(!m_bMoving) {
+            m_dSpeed = 0;
+            m_nTime = nTime;
+        }
+        m_dTargetAz = Normalize(dTargetAz);
+        m_bHasTarget = true;
+        m_bMoving = true;
+    }
+
+    // position known without motion (sync, abort)
+    void SetPosition(double dAz, long long nTime)
+    {
+        m_dAz = Normalize(dAz);
+        m_nTime = nTime;
+        m_dSpeed = 0;
+        m_bMoving = false;
+        m_bHasTarget = false;
+    }
+
+    void Stop() { m_bHasTarget = false; m_bMoving = false; m_dSpeed = 0; }
+
+    bool IsMoving() const { return m_bMoving; }
+
+    // false when there is no goto in progress
+    bool GetTarget(double &dAz) const
+    {
+        dAz = m_dTargetAz;
+        return m_bHasTarget;
+    }
+
+    // false if there is nothing to extrapolate from or the last sample is too old
+    bool Predict(long long nNow, double &dAz) const
+    {
+        double dDt;
+        double dDistance;
+        double dDirection;
+        double dTravel;
+
+        if(!m_nTime || nNow - m_nTime > MOTION_MAX_HORIZON)
+            return false;
+
+        dAz = m_dAz;
+        if(!m_bMoving || nNow <= m_nTime)
+            return true;
+
+        dDt = double(nNow - m_nTime) * 1e-9;
+        if(!m_bHasTarget) {
+            // direction unknown without a target, stay put rather than guess
+            return true;
+        }
+
+        dDistance = AngleDiff(m_dAz, m_dTargetAz);
+        dDirection = dDistance < 0 ? -1.0 : 1.0;
+        dDistance = fabs(dDistance);
+        if(HasProfile())
+            dTravel = TrapezoidTravel(dDistance, dDt);
+        else
+            dTravel = m_dSpeed * dDt;
+        if(dTravel > dDistance)
+            dTravel = dDistance;
+
+        dAz = Normalize(m_dAz + dDirection * dTravel);
+        return true;
+    }
+
+    // seconds left to reach the target from the last sample, -1 if unknown
+    double TimeToTarget() const
+    {
+        double dDistance;
+
+        if(!m_bHasTarget || !HasProfile())
+            return -1;
+        dDistance = fabs(AngleDiff(m_dAz, m_dTargetAz));
+        return TrapezoidTime(dDistance, m_dSpeed);
+    }
+
+    // seconds to cover dDistance degrees starting at dStartSpeed in the direction of travel, -1 without a profile
+    double MoveTime(double dDistance, double dStartSpeed) const
+    {
+        if(!HasProfile())
+            return -1;
+        return TrapezoidTime(fabs(dDistance), dStartSpeed);
+    }
+
+    // degrees needed to slow down from dSpeed to the min speed, 0 without a known acceleration
+    double BrakingDistance(double dSpeed) const
+    {
+        if(m_dAccel <= 0 || dSpeed <= m_dMinSpeed)
+            return 0;
+        return (dSpeed * dSpeed - m_dMinSpeed * m_dMinSpeed) / (2.0 * m_dAccel);
+    }
+
+    double GetAccel() const { return m_dAccel; }
+
+    // degree/s, positive when the azimuth increases, 0 when stopped or the direction is unknown
+    double GetVelocity() const
+    {
+        if(!m_bMoving || !m_bHasTarget)
+            return 0;
+        return AngleDiff(m_dAz, m_dTargetAz) < 0 ? -m_dSpeed : m_dSpeed;
+    }
+
+    static double Normalize(double dAz)
+    {
+        dAz = fmod(dAz, 360.0);
+        return dAz < 0 ? dAz + 360.0 : dAz;
+    }
+
+    // signed shortest angle from dFrom to dTo, in [-180, 180)
+    static double AngleDiff(double dFrom, double dTo)
+    {
+        double dDiff = Normalize(dTo - dFrom);
+        return dDiff >= 180.0 ? dDiff - 360.0 : dDiff;
+    }
+
+protected:
+    // Phases of the profile from the current speed over dDistance. Without acceleration
+    // the dome is assumed to move at max speed.
+    void Trapezoid(double dDistance, double dStartSpeed, double &dV0, double &dPeak, double &dEnd, double &dD1, double &dD3) const
+    {
+        dEnd = m_dMinSpeed;
+        dV0 = dStartSpeed > m_dMinSpeed ? dStartSpeed : m_dMinSpeed;
+        if(m_dAccel <= 0) {
+            dV0 = dPeak = dEnd = m_dMaxSpeed;
+            dD1 = dD3 = 0;
+            return;
+        }
+        // highest speed reachable while still being able to brake to the end speed
+        dPeak = sqrt((2.0 * m_dAccel * dDistance + dV0 * dV0 + dEnd * dEnd) / 2.0);
+        if(dPeak > m_dMaxSpeed)
+            dPeak = m_dMaxSpeed;
+        if(dPeak < dV0)
+            dPeak = dV0;    // already faster than the profile allows, brake from here
+        if(dEnd > dPeak)
+            dEnd = dPeak;
+        dD1 = (dPeak * dPeak - dV0 * dV0) / (2.0 * m_dAccel);
+        dD3 = (dPeak * dPeak - dEnd * dEnd) / (2.0 * m_dAccel);
+    }
+
+    double TrapezoidTravel(double dDistance, double dDt) const
+    {
+        double dV0, dPeak, dEnd, dD1, dD3;
+        double dT1, dT2, dD2;
+
+        Trapezoid(dDistance, m_dSpeed, dV0, dPeak, dEnd, dD1, dD3);
+        if(m_dAccel <= 0)
+            return dPeak * dDt;
+
+        dT1 = (dPeak - dV0) / m_dAccel;
+        if(dDt <= dT1)
+            return dV0 * dDt + 0.5 * m_dAccel * dDt * dDt;
+        dD2 = dDistance - dD1 - dD3;
+        if(dD2 < 0)
+            dD2 = 0;
+        dT2 = dD2 / dPeak;
+        if(dDt <= dT1 + dT2)
+            return dD1 + dPeak * (dDt - dT1);
+        dDt -= dT1 + dT2;
+        if(dDt >= (dPeak - dEnd) / m_dAccel)
+            return dD1 + dD2 + dD3 + dEnd * (dDt - (dPeak - dEnd) / m_dAccel);
+        return dD1 + dD2 + dPeak * dDt - 0.5 * m_dAccel * dDt * dDt;
+    }
+
+    double TrapezoidTime(double dDistance, double dStartSpeed) const
+    {
+        double dV0, dPeak, dEnd, dD1, dD3;
+        double dD2;
+
+        Trapezoid(dDistance, dStartSpeed, dV0, dPeak, dEnd, dD1, dD3);
+        if(dPeak <= 0)
+            return -1;
+        if(m_dAccel <= 0)
+            return dDistance / dPeak;
+        dD2 = dDistance - dD1 - dD3;
+        if(dD2 < 0)
+            dD2 = 0;
+        return (dPeak - dV0) / m_dAccel + dD2 / dPeak + (dPeak - dEnd) / m_dAccel;
+    }
+
+    double      m_dMinSpeed;
+    double      m_dMaxSpeed;
+    double      m_dAccel;
+
+    double      m_dAz;          // last sample
+    double      m_dSpeed;       // degree/s, unsigned
+    long long   m_nTime;        // ns, same clock as the caller's
+    bool        m_bMoving;
+    bool        m_bHasTarget;
+    double      m_dTargetAz;
+};
+
+#endif
@@ -0,0 +1,172 @@
+//
+//  GotoTolerance.h
+//  LunaticoBeaver X2 plugin
+//
+//  How close to its target a goto has to stop to be considered done, learned from
+//  the final errors of past gotos. Errors are binned by goto distance and rotation
+//  speed, as longer and faster slews coast further. The tolerance of a bin is its
+//  mean error plus 3 standard deviations, or the pooled one until the bin has seen
+//  enough gotos, or the old fixed 2 degrees until the dome has seen enough gotos.
+//  A goto is judged against the tolerance from before its own error is added.
+//  The statistics slowly forget, so they follow mechanical changes.
+
+#ifndef __GotoTolerance__
+#define __GotoTolerance__
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#define TOLERANCE_DIST_BINS     4       // < 10, < 45, < 90, >= 90 degrees
+#define TOLERANCE_SPEED_BINS    3       // < 2, < 5, >= 5 degree/s
+#define TOLERANCE_NB_BINS       (TOLERANCE_DIST_BINS * TOLERANCE_SPEED_BINS)
+#define TOLERANCE_DEFAULT       2.0     // degrees, until we know better
+#define TOLERANCE_MIN           0.5     // degrees, below the controller's own positioning noise
+#define TOLERANCE_MAX           5.0     // degrees, limit until the slit width is known, see SetMaxTolerance
+#define TOLERANCE_MIN_SAMPLES   5
+#define TOLERANCE_SIGMAS        3.0
+#define TOLERANCE_MAX_ERROR     20.0    // degrees, anything larger is a stall or an abort, not an overshoot
+#define TOLERANCE_HISTORY       50      // gotos, older ones fade out
+#define TOLERANCE_STATS_SIZE    512     // serialised statistics
+
+class CGotoTolerance
+{
+public:
+    CGotoTolerance() : m_dMaxTolerance(TOLERANCE_MAX), m_bChanged(false) { Reset(); }
+
+    void Reset()
+    {
+        for(int i = 0; i <= TOLERANCE_NB_BINS; i++)
+            m_Bins[i].Reset();
+        m_bChanged = true;
+    }
+
+    // the largest error that still keeps the telescope inside the slit
+    void SetMaxTolerance(double dMax) { m_dMaxTolerance = dMax > TOLERANCE_MIN ? dMax : TOLERANCE_MIN; }
+
+    // dError is how far from the target the dome stopped, in degrees
+    void Add(double dDistance, double dSpeed, double dError)
+    {
+        dError = fabs(dError);
+        if(dError > TOLERANCE_MAX_ERROR)
+            return;
+        m_Bins[binIndex(dDistance, dSpeed)].Add(dError);
+        m_Bins[TOLERANCE_NB_BINS].Add(dError);
+        m_bChanged = true;
+    }
+
+    double Get(double dDistance, double dSpeed) const
+    {
+        const ErrorStats &Bin = m_Bins[binIndex(dDistance, dSpeed)];
+
+        if(Bin.dCount >= TOLERANCE_MIN_SAMPLES)
+            return clamp(Bin.Tolerance());
+        return GetOverall();
+    }
+
+    // when the distance of the move isn't known
+    double GetOverall() const
+    {
+        const ErrorStats &Pooled = m_Bins[TOLERANCE_NB_BINS];
+
+        if(Pooled.dCount >= TOLERANCE_MIN_SAMPLES)
+            return clamp(Pooled.Tolerance());
+        return clamp(TOLERANCE_DEFAULT);
+    }
+
+    unsigned long GetSamples() const { return (unsigned long)m_Bins[TOLERANCE_NB_BINS].dCount; }
+
+    // true once after each change, so the caller knows when to save
+    bool TakeChanged() { bool bChanged = m_bChanged; m_bChanged = false; return bChanged; }
+
+    // "count mean m2" per bin, in thousandths so the ini doesn't depend on the decimal separator
+    void Serialize(std::string &sStats) const
+    {
+        char szBin[64];
+
+        sStats.clear();
+        for(int i = 0; i <= TOLERANCE_NB_BINS; i++) {
+            snprintf(szBin, sizeof(szBin), "%s%ld %ld %ld", i ? " " : "", long(m_Bins[i].dCount * 1000.0), long(m_Bins[i].dMean * 1000.0), long(m_Bins[i].dM2 * 1000.0));
+            sStats += szBin;
+        }
+    }
+
+    bool Deserialize(const std::string &sStats)
+    {
+        ErrorStats Bins[TOLERANCE_NB_BINS + 1];
+        const char *pszCur = sStats.c_str();
+        char *pszEnd;
+        long nValues[3];
+
+        for(int i = 0; i <= TOLERANCE_NB_BINS; i++) {
+            for(int j = 0; j < 3; j++) {
+                nValues[j] = strtol(pszCur, &pszEnd, 10);
+                if(pszEnd == pszCur || nValues[j] < 0)
+                    return false;
+                pszCur = pszEnd;
+            }
+            Bins[i].dCount = nValues[0] / 1000.0;
+            Bins[i].dMean = nValues[1] / 1000.0;
+            Bins[i].dM2 = nValues[2] / 1000.0;
+        }
+        for(int i = 0; i <= TOLERANCE_NB_BINS; i++)
+            m_Bins[i] = Bins[i];
+        m_bChanged = false;
+        return true;
+    }
+
+protected:
+    // running mean and variance (Welford), turning into exponential averages
+    // once the history is full.
+    struct ErrorStats {
+        double dCount;
+        double dMean;
+        double dM2;
+
+        void Reset() { dCount = 0; dMean = 0; dM2 = 0; }
+
+        void Add(double dError)
+        {
+            double dDelta;
+
+            if(dCount < TOLERANCE_HISTORY)
+                dCount += 1;
+            else
+                dM2 *= (TOLERANCE_HISTORY - 1.0) / TOLERANCE_HISTORY;
+            dDelta = dError - dMean;
+            dMean += dDelta / dCount;
+            dM2 += dDelta * (dError - dMean);
+        }
+
+        double Tolerance() const
+        {
+            double dVariance = dCount > 1 ? dM2 / (dCount - 1) : 0;
+            return dMean + TOLERANCE_SIGMAS * sqrt(dVariance > 0 ? dVariance : 0);
+        }
+    };
+
+    static int binIndex(double dDistance, double dSpeed)
+    {
+        int nDist;
+        int nSpeed;
+
+        dDistance = fabs(dDistance);
+        nDist = dDistance < 10 ? 0 : (dDistance < 45 ? 1 : (dDistance < 90 ? 2 : 3));
+        nSpeed = dSpeed < 2 ? 0 : (dSpeed < 5 ? 1 : 2);
+        return nDist * TOLERANCE_SPEED_BINS + nSpeed;
+    }
+
+    double clamp(double dTolerance) const
+    {
+        if(dTolerance < TOLERANCE_MIN)
+            return TOLERANCE_MIN;
+        return dTolerance > m_dMaxTolerance ? m_dMaxTolerance : dTolerance;
+    }
+
+    ErrorStats  m_Bins[TOLERANCE_NB_BINS + 1];  // the last one pools all the gotos
+    double      m_dMaxTolerance;
+    bool        m_bChanged;
+};
+
+#endif
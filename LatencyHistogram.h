@@ -0,0 +1,110 @@
+//
+//  LatencyHistogram.h
+//  LunaticoBeaver X2 plugin
+//
+//  Log-linear latency histogram : 4 linear buckets per power of 2 of microseconds,
+//  so the percentiles are within 25% of the real value from 1 us to ~1 minute.
+
+#ifndef __LatencyHistogram__
+#define __LatencyHistogram__
+
+#include <string.h>
+
+#define LATENCY_SUB_BUCKETS_BITS    2
+#define LATENCY_SUB_BUCKETS         (1 << LATENCY_SUB_BUCKETS_BITS)
+#define LATENCY_MAX_POWER           26      // 2^26 us ~ 67 seconds
+#define LATENCY_NB_BUCKETS          ((LATENCY_MAX_POWER + 1) * LATENCY_SUB_BUCKETS)
+
+class CLatencyHistogram
+{
+public:
+    CLatencyHistogram() { Reset(); }
+
+    void Reset()
+    {
+        memset(m_nBuckets, 0, sizeof(m_nBuckets));
+        m_nCount = 0;
+        m_nTimeouts = 0;
+        m_nErrors = 0;
+        m_nMaxUs = 0;
+        m_nTotalUs = 0;
+    }
+
+    void Add(unsigned long long nUs)
+    {
+        m_nBuckets[bucketIndex(nUs)]++;
+        m_nCount++;
+        m_nTotalUs += nUs;
+        if(nUs > m_nMaxUs)
+            m_nMaxUs = nUs;
+    }
+
+    void AddTimeout()   { m_nTimeouts++; }
+    void AddError()     { m_nErrors++; }
+
+    unsigned long       GetCount() const    { return m_nCount; }
+    unsigned long       GetTimeouts() const { return m_nTimeouts; }
+    unsigned long       GetErrors() const   { return m_nErrors; }
+    unsigned long long  GetMaxUs() const    { return m_nMaxUs; }
+    unsigned long long  GetMeanUs() const   { return m_nCount ? m_nTotalUs / m_nCount : 0; }
+
+    // upper bound of the bucket holding the requested percentile (0-100), capped by the max seen.
+    unsigned long long GetPercentileUs(double dPercentile) const
+    {
+        unsigned long nRank;
+        unsigned long nSeen = 0;
+
+        if(!m_nCount)
+            return 0;
+
+        nRank = (unsigned long)(dPercentile / 100.0 * m_nCount + 0.5);
+        if(nRank < 1)
+            nRank = 1;
+        if(nRank > m_nCount)
+            nRank = m_nCount;
+
+        for(int i = 0; i < LATENCY_NB_BUCKETS; i++) {
+            nSeen += m_nBuckets[i];
+            if(nSeen >= nRank)
+                return bucketUpperBound(i) < m_nMaxUs ? bucketUpperBound(i) : m_nMaxUs;
+        }
+        return m_nMaxUs;
+    }
+
+protected:
+    static int bucketIndex(unsigned long long nUs)
+    {
+        int nPower = 0;
+        int nIndex;
+
+        if(nUs < LATENCY_SUB_BUCKETS)
+            return int(nUs);
+
+        while((nUs >> nPower) > 1)
+            nPower++;
+        nIndex = (nPower - LATENCY_SUB_BUCKETS_BITS + 1) * LATENCY_SUB_BUCKETS + int((nUs >> (nPower - LATENCY_SUB_BUCKETS_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+        return nIndex < LATENCY_NB_BUCKETS ? nIndex : LATENCY_NB_BUCKETS - 1;
+    }
+
+    static unsigned long long bucketUpperBound(int nIndex)
+    {
+        int nPower;
+        int nSub;
+
+        if(nIndex < LATENCY_SUB_BUCKETS)
+            return (unsigned long long)nIndex;
+
+        nPower = nIndex / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS_BITS - 1;
+        nSub = nIndex % LATENCY_SUB_BUCKETS;
+        return ((unsigned long long)(LATENCY_SUB_BUCKETS + nSub + 1) << (nPower - LATENCY_SUB_BUCKETS_BITS)) - 1;
+    }
+
+    unsigned long       m_nBuckets[LATENCY_NB_BUCKETS];
+    unsigned long       m_nCount;
+    unsigned long       m_nTimeouts;
+    unsigned long       m_nErrors;
+    unsigned long long  m_nMaxUs;
+    unsigned long long  m_nTotalUs;
+};
+
+#endif
@@ -34,16 +34,52 @@ CLunaticoBeaver::CLunaticoBeaver()
     m_nGotoTries = 0;
 
     m_nRainSensorstate = NOT_RAINING;
-    m_nRainStatus = RAIN_UNNOWN;
     m_bSaveRainStatus = false;
-    m_cRainCheckTimer.Reset();
+    m_nRainAction = DO_NOTHING;
+    m_bRainCloseShutter = false;
+    m_nRainSampleInterval = RAIN_SAMPLE_INTERVAL;
+    m_nRainDebounce = RAIN_DEBOUNCE;
+    m_nRainCloseSent = 0;
+    m_nRainCloseTried = 0;
+    m_bRainMovePending = false;
+    m_nRainMoveTried = 0;
+    m_bTelemetry = false;
+    m_nBatteryRefreshTime = 0;
 
     m_bHomeOnPark = false;
     m_bHomeOnUnpark = false;
 
     m_bShutterPresent = false;
 
-#ifdef PLUGIN_DEBUG
+    m_sRxBuffer.reserve(SERIAL_BUFFER_SIZE * 2);
+    m_sTxBuffer.reserve(SERIAL_BUFFER_SIZE);
+    m_nvBatchSent.reserve(16);
+
+    m_bPollerRunning = false;
+    m_nPollInterval = STATUS_POLL_INTERVAL;
+    m_nSnapshotSeq = 0;
+    m_nSnapshotStatus = 0;
+    m_dSnapshotAz = 0.0;
+    m_nSnapshotTime = 0;
+    m_nStateChangeTime = 0;
+    m_nCacheHits = 0;
+    m_nCacheMisses = 0;
+
+    m_pLogger = NULL;
+    m_pClock = NULL;
+    m_dGotoDistance = 0;
+    m_dGotoSpeed = 0;
+    m_bGotoVia = false;
+    m_nGotoDirection = 1;
+    m_bGotoAbsorbed = false;
+    m_bGotoCancelled = false;
+    m_nAbortRequestTime = 0;
+    m_nDroppedPolls = 0;
+    m_nMotionCmdCount = 0;
+    m_nAbortedMotionCount = (unsigned long)-1;  // nothing aborted yet
+    m_sStatsVerb.reserve(64);
+    m_cStatsLogTimer.Reset();
+
 #if defined(SB_WIN_BUILD)
     m_sLogfilePath = getenv("HOMEDRIVE");
     m_sLogfilePath += getenv("HOMEPATH");
@@ -55,7 +91,12 @@ CLunaticoBeaver::CLunaticoBeaver()
     m_sLogfilePath = getenv("HOME");
     m_sLogfilePath += "/LunaticoBeaver-Log.txt";
 #endif
-    m_sLogFile.open(m_sLogfilePath, std::ios::out |std::ios::trunc);
+    // logging is off until setLogLevel is called, unless this is a debug build
+    m_nLogLevel = LOG_OFF;
+    m_nLogCategories = LOG_ALL;
+    m_nLogFilter = 0;
+#ifdef PLUGIN_DEBUG
+    setLogLevel(PLUGIN_DEBUG, LOG_ALL);
 #endif
 
 #if defined(SB_WIN_BUILD)
@@ -70,32 +111,25 @@ CLunaticoBeaver::CLunaticoBeaver()
     m_sRainStatusfilePath += "/LunaticoBeaver_Rain.txt";
 #endif
     
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [CLunaticoBeaver] Version " << std::fixed << std::setprecision(2) << PLUGIN_VERSION << " build " << __DATE__ << " " << __TIME__ << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [CLunaticoBeaver] Constructor Called." << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [CLunaticoBeaver] Rains status file : " << m_sRainStatusfilePath<<std::endl;
-    m_sLogFile.flush();
-#endif
+    m_RainStatusFile.SetPath(m_sRainStatusfilePath);
+    PLUGIN_LOG(LOG_DEBUG, LOG_RAIN) << " [CLunaticoBeaver] Rains status file : " << m_sRainStatusfilePath<<std::endl;
 
 }
 
 CLunaticoBeaver::~CLunaticoBeaver()
 {
-#ifdef	PLUGIN_DEBUG
+    stopStatusPoller();
     // Close LogFile
     if(m_sLogFile.is_open())
         m_sLogFile.close();
-#endif
 }
 
 int CLunaticoBeaver::Connect(const char *pszPort)
 {
     int nErr;
+    std::vector<double> dvValues;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Connect Called." << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Connect] Connect Called." << std::endl;
     m_bIsConnected = false;
     m_bCalibrating = false;
     m_bUnParking = false;
@@ -106,59 +140,61 @@ int CLunaticoBeaver::Connect(const char *pszPort)
         return nErr;
     }
     m_bIsConnected = true;
+    clearResponseCache();
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] connected to " << pszPort << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Connect] connected to " << pszPort << std::endl;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Getting Firmware." << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Connect] Getting Firmware." << std::endl;
 
     // if this fails we're not properly connected.
     nErr = getFirmwareVersion(m_sFirmwareVersion);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Error getting Firmware : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Connect] Error getting Firmware : " << nErr << std::endl;
         m_bIsConnected = false;
         m_pSerx->close();
         return FIRMWARE_NOT_SUPPORTED;
     }
-    nErr = getDomeParkAz(m_dCurrentAzPosition);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Error getDomeParkAz : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
-        return nErr;
-    }
-    nErr = getDomeHomeAz(m_dHomeAz);
+    // park, home and shutter enable in one round trip
+    nErr = getValues({"!domerot getpark#", "!domerot gethome#", "!dome getshutterenable#"}, dvValues);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Error getDomeHomeAz : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Connect] Error getting park, home and shutter enable : " << nErr << std::endl;
         return nErr;
     }
+    m_dParkAz = dvValues[0];
+    m_dCurrentAzPosition = m_dParkAz;
+    m_dHomeAz = dvValues[1];
+    m_bShutterPresent = (int(dvValues[2]) == 1);
 
-    getShutterPresent(m_bShutterPresent);
+    // the poller and the status reads publish the rain state as they decode it
+    m_RainStatusFile.Start();
+    if(m_bTelemetry && !m_Telemetry.Open()) {
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [Connect] can't create the telemetry segment " << TELEMETRY_NAME << std::endl;
+    }
+    updateTelemetryAz(m_dCurrentAzPosition);
 
-    writeRainStatus();
-    m_cRainCheckTimer.Reset();
+    // the first background read gets the cutoff
+    m_BatteryCache.Reset();
+    m_nBatteryRefreshTime = 0;
 
     setMaxRotationTime(300);
+    m_MotionModel.Reset();
+    updateMotionProfile();
+
+    startStatusPoller();
     return SB_OK;
 }
 
 
 void CLunaticoBeaver::Disconnect()
 {
+    stopStatusPoller();
+    m_RainStatusFile.Stop();
+    m_Telemetry.Close();
+    logCommandStats();
+
     if(m_bIsConnected) {
         abortCurrentCommand();
+        CPriorityLocker lock(m_PortLock, PRIORITY_MOTION);
         m_pSerx->purgeTxRx();
         m_pSerx->close();
     }
@@ -166,53 +202,171 @@ void CLunaticoBeaver::Disconnect()
     m_bCalibrating = false;
     m_bUnParking = false;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Disconnect] Error m_bIsConnected : " << (m_bIsConnected?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    logCacheStats();
+    clearResponseCache();
+
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [Disconnect] Error m_bIsConnected : " << (m_bIsConnected?"Yes":"No") << std::endl;
 }
 
 
-int CLunaticoBeaver::domeCommand(const std::string sCmd, std::string &sResp, int nTimeout)
+int CLunaticoBeaver::domeCommand(const std::string sCmd, std::string &sResp, int nTimeout, int nPriority)
 {
     int nErr = PLUGIN_OK;
     unsigned long  ulBytesWrite;
 
+    if(getCachedResponse(sCmd, sResp)) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommand] cached response to " << sCmd << " : " << sResp << std::endl;
+        return nErr;
+    }
+
+    if(nPriority == PRIORITY_FROM_VERB)
+        nPriority = getCommandPriority(sCmd);
+    CPriorityLocker lock(m_PortLock, nPriority);
+
+    if(isRelayCommand(sCmd) && !m_ShutterLink.Acquire(1, !isQueryCommand(sCmd), steadyNow())) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommand] over the shutter link budget : " << sCmd << std::endl;
+        return SHUTTER_LINK_BUSY;
+    }
+
+    // anything that isn't a query can change what the cached queries would return
+    if(!isQueryCommand(sCmd))
+        clearResponseCache();
+
+    // records the round trip with whatever nErr is when we return
+    auto Timer = MakeScopedTimer([&](long long nNs) { recordCommandLatency(sCmd, nNs/1000, nErr); }, m_pClock);
     m_pSerx->purgeTxRx();
+    m_sRxBuffer.clear();
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [domeCommand] sending : " << sCmd << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommand] sending : " << sCmd << std::endl;
 
     nErr = m_pSerx->writeFile((void *)sCmd.c_str(), sCmd.size(), ulBytesWrite);
     m_pSerx->flushTx();
     if(nErr)
         return nErr;
+    commandWritten(sCmd);
 
     // read response
     nErr = readResponse(sResp, nTimeout);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [domeCommand] ***** ERROR READING RESPONSE **** error = " << nErr << " , response : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommand] ***** ERROR READING RESPONSE **** error = " << nErr << " , response : " << sResp << std::endl;
         return nErr;
     }
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [domeCommand] response : " << sResp << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommand] response : " << sResp << " (" << Timer.GetElapsedNanoseconds()/1000 << " us)" << std::endl;
+    cacheResponse(sCmd, sResp);
 
     return nErr;
 }
 
 int CLunaticoBeaver::shutterCommand(const std::string sCmd, std::string &sResp, int nTimeout)
 {
+    int nErr;
     std::string newCmd;
 
     newCmd="!dome sendtoshutter \""+sCmd+"\"#";
-    return domeCommand(newCmd, sResp, nTimeout);
+    if(!isQueryCommand(newCmd))
+        return domeCommand(newCmd, sResp, nTimeout);
+
+    // the same query from another caller is already on its way, share its answer
+    if(!m_ShutterLink.BeginQuery(newCmd, sResp, nErr))
+        return nErr;
+    nErr = domeCommand(newCmd, sResp, nTimeout);
+    m_ShutterLink.EndQuery(newCmd, sResp, nErr);
+    return nErr;
+}
+
+int CLunaticoBeaver::domeCommandBatch(const std::vector<std::string> &svCmds, std::vector<std::string> &svResps, int nTimeout, bool bUseCache, bool bDroppable)
+{
+    int nErr = PLUGIN_OK;
+    unsigned long  ulBytesWrite;
+    CStopWatch cCmdTimer(m_pClock);
+    int nPriority = PRIORITY_DIAGNOSTIC;
+
+    // responses are read in place so a caller reusing svResps doesn't reallocate them.
+    svResps.resize(svCmds.size());
+    if(svCmds.empty())
+        return nErr;
+
+    // the batch goes out at the priority of its most urgent command
+    for(size_t i = 0; i < svCmds.size(); i++)
+        nPriority = std::min(nPriority, getCommandPriority(svCmds[i]));
+    CPriorityLocker lock(m_PortLock, nPriority, bDroppable);
+    if(!lock.IsLocked()) {
+        m_nDroppedPolls++;
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommandBatch] dropped for a pending abort" << std::endl;
+        return ERR_CMDFAILED;
+    }
+    // relayed commands are never served from the cache, so they all go out
+    if(!acquireRelayBudget(svCmds)) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommandBatch] over the shutter link budget" << std::endl;
+        return SHUTTER_LINK_BUSY;
+    }
+
+    // the controller answers in order, so all commands not served from the cache
+    // go out back to back and the responses are split on their '#' terminators.
+    m_sTxBuffer.clear();
+    m_nvBatchSent.clear();
+    for(size_t i = 0; i < svCmds.size(); i++) {
+        if(bUseCache && getCachedResponse(svCmds[i], svResps[i]))
+            continue;
+        if(!isQueryCommand(svCmds[i]))
+            clearResponseCache();
+        m_sTxBuffer += svCmds[i];
+        m_nvBatchSent.push_back(i);
+    }
+    if(m_nvBatchSent.empty())
+        return nErr;
+    cCmdTimer.Reset();
+    m_pSerx->purgeTxRx();
+    m_sRxBuffer.clear();
+
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommandBatch] sending : " << m_sTxBuffer << std::endl;
+
+    nErr = m_pSerx->writeFile((void *)m_sTxBuffer.c_str(), m_sTxBuffer.size(), ulBytesWrite);
+    m_pSerx->flushTx();
+    if(nErr) {
+        for(size_t j = 0; j < m_nvBatchSent.size(); j++)
+            recordCommandLatency(svCmds[m_nvBatchSent[j]], 0, nErr);
+        return nErr;
+    }
+    for(size_t j = 0; j < m_nvBatchSent.size(); j++)
+        commandWritten(svCmds[m_nvBatchSent[j]]);
+
+    for(size_t j = 0; j < m_nvBatchSent.size(); j++) {
+        size_t i = m_nvBatchSent[j];
+        nErr = readResponse(svResps[i], nTimeout);
+        // each command is charged the time since the previous response, its marginal cost in the batch
+        recordCommandLatency(svCmds[i], cCmdTimer.GetElapsedMicroseconds(), nErr);
+        cCmdTimer.Reset();
+        if(nErr) {
+            PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommandBatch] ***** ERROR READING RESPONSE **** to " << svCmds[i] << " error = " << nErr << " , response : " << svResps[i] << std::endl;
+            return nErr;
+        }
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [domeCommandBatch] response : " << svResps[i] << std::endl;
+        cacheResponse(svCmds[i], svResps[i]);
+    }
+
+    return nErr;
+}
+
+int CLunaticoBeaver::getValues(const std::vector<std::string> &svCmds, std::vector<double> &dvValues)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> svResps;
+
+    dvValues.assign(svCmds.size(), 0);
+
+    nErr = domeCommandBatch(svCmds, svResps);
+    if(nErr)
+        return nErr;
+
+    for(size_t i = 0; i < svResps.size(); i++) {
+        nErr = parseValue(svResps[i], dvValues[i]);
+        if(nErr) {
+            PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [getValues] conversion error for " << svCmds[i] << " : " << svResps[i] << std::endl;
+            return ERR_CMDFAILED;
+        }
+    }
+    return nErr;
 }
 
 int CLunaticoBeaver::readResponse(std::string &sResp, int nTimeout)
@@ -220,74 +374,55 @@ int CLunaticoBeaver::readResponse(std::string &sResp, int nTimeout)
     int nErr = PLUGIN_OK;
     char pszBuf[SERIAL_BUFFER_SIZE];
     unsigned long ulBytesRead = 0;
-    unsigned long ulTotalBytesRead = 0;
-    char *pszBufPtr;
     int nBytesWaiting = 0 ;
-    int nbTimeouts = 0;
+    long nTimeLeft;
+    size_t nTermPos;
+    std::chrono::steady_clock::time_point tDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeout);
 
     sResp.clear();
-    memset(pszBuf, 0, SERIAL_BUFFER_SIZE);
-    pszBufPtr = pszBuf;
 
-    do {
-        nErr = m_pSerx->bytesWaitingRx(nBytesWaiting);
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 3
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] nBytesWaiting      : " << nBytesWaiting << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] nBytesWaiting nErr : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
-        if(!nBytesWaiting) {
-            nbTimeouts += MAX_READ_WAIT_TIMEOUT;
-            if(nbTimeouts >= nTimeout) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 3
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] bytesWaitingRx timeout, no data for " << nbTimeouts << " ms"<< std::endl;
-                m_sLogFile.flush();
-#endif
-                nErr = COMMAND_TIMEOUT;
-                break;
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(MAX_READ_WAIT_TIMEOUT));
-            continue;
-        }
-        nbTimeouts = 0;
-        if(ulTotalBytesRead + nBytesWaiting <= SERIAL_BUFFER_SIZE)
-            nErr = m_pSerx->readFile(pszBufPtr, nBytesWaiting, ulBytesRead, nTimeout);
-        else {
-            nErr = ERR_RXTIMEOUT;
-            break; // buffer is full.. there is a problem !!
+    // bytes left over from a previous read may already hold part (or all) of this response
+    while((nTermPos = m_sRxBuffer.find('#')) == std::string::npos) {
+        nTimeLeft = (long)std::chrono::duration_cast<std::chrono::milliseconds>(tDeadline - std::chrono::steady_clock::now()).count();
+        if(nTimeLeft <= 0) {
+            PLUGIN_LOG(LOG_TRACE, LOG_TRANSPORT) << " [readResponse] timeout, no terminator after " << nTimeout << " ms"<< std::endl;
+            nErr = COMMAND_TIMEOUT;
+            break;
         }
+
+        nErr = m_pSerx->bytesWaitingRx(nBytesWaiting);
+        PLUGIN_LOG(LOG_TRACE, LOG_TRANSPORT) << " [readResponse] nBytesWaiting      : " << nBytesWaiting << std::endl;
+        PLUGIN_LOG(LOG_TRACE, LOG_TRANSPORT) << " [readResponse] nBytesWaiting nErr : " << nErr << std::endl;
+        // nothing there yet, block on the next byte so we wake up as soon as it arrives
+        if(nErr || nBytesWaiting <= 0)
+            nBytesWaiting = 1;
+        if(nBytesWaiting > SERIAL_BUFFER_SIZE)
+            nBytesWaiting = SERIAL_BUFFER_SIZE;
+
+        nErr = m_pSerx->readFile(pszBuf, nBytesWaiting, ulBytesRead, nTimeLeft);
         if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] readFile error : " << nErr << std::endl;
-            m_sLogFile.flush();
-#endif
+            PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [readResponse] readFile error : " << nErr << std::endl;
+            m_sRxBuffer.clear();
             return nErr;
         }
 
-        if (ulBytesRead != nBytesWaiting) { // timeout
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] rreadFile Timeout Error." << std::endl;
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] readFile nBytesWaiting : " << nBytesWaiting << std::endl;
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] readFile ulBytesRead   : " << ulBytesRead << std::endl;
-            m_sLogFile.flush();
-#endif
+        m_sRxBuffer.append(pszBuf, ulBytesRead);
+        if(m_sRxBuffer.size() > SERIAL_BUFFER_SIZE) {
+            nErr = ERR_RXTIMEOUT;
+            break; // buffer is full.. there is a problem !!
         }
+    }
 
-        ulTotalBytesRead += ulBytesRead;
-        pszBufPtr+=ulBytesRead;
-    }  while (ulTotalBytesRead < SERIAL_BUFFER_SIZE  && *(pszBufPtr-1) != '#');
-
-    if(!ulTotalBytesRead)
-        nErr = COMMAND_TIMEOUT; // we didn't get an answer.. so timeout
-    else
-        *(pszBufPtr-1) = 0; //remove the #
+    if(nErr) {
+        sResp.assign(m_sRxBuffer);
+        m_sRxBuffer.clear();
+        return nErr;
+    }
 
-    sResp.assign(pszBuf);
+    sResp.assign(m_sRxBuffer, 0, nTermPos); //remove the #
+    m_sRxBuffer.erase(0, nTermPos + 1);
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 3
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] sResp : " << sResp << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_TRACE, LOG_TRANSPORT) << " [readResponse] sResp : " << sResp << std::endl;
 
     return nErr;
 }
@@ -296,46 +431,43 @@ int CLunaticoBeaver::readResponse(std::string &sResp, int nTimeout)
 int CLunaticoBeaver::getDomeAz(double &dDomeAz)
 {
     int nErr = PLUGIN_OK;
+    int nStatus;
+    long long nSampleTime;
     std::string sResp;
-    std::vector<std::string> svFields;
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
     if(m_bCalibrating)
         return nErr;
 
-    nErr = domeCommand("!dome getaz#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
-        return nErr;
+    // the poller already has a recent position, no need to ask the controller
+    if(getStatusSnapshot(nStatus, dDomeAz)) {
+        m_dCurrentAzPosition = dDomeAz;
     }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            dDomeAz = std::stod(svFields[1]);
+    else {
+        nSampleTime = steadyNow();
+        nErr = domeCommand("!dome getaz#", sResp);
+        if(nErr) {
+            PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
+            return nErr;
         }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeAz] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
+        // convert Az string to double
+        nErr = parseValue(sResp, dDomeAz);
+        if(nErr) {
+            PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeAz] conversion error : " << sResp << std::endl;
             return ERR_CMDFAILED;
         }
         m_dCurrentAzPosition = dDomeAz;
-    }
-    if(m_cRainCheckTimer.GetElapsedSeconds() > RAIN_CHECK_INTERVAL) {
-        writeRainStatus();
-        m_cRainCheckTimer.Reset();
+        {
+            // no status with it, so the model keeps its moving state
+            std::lock_guard<std::mutex> lock(m_MotionMutex);
+            m_MotionModel.AddSample(dDomeAz, nSampleTime, m_MotionModel.IsMoving());
+        }
+        if(!m_bPollerRunning)
+            updateTelemetryAz(dDomeAz);
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dParkAz << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dParkAz << std::endl;
 
     return nErr;
 }
@@ -368,7 +500,6 @@ int CLunaticoBeaver::getDomeHomeAz(double &dAz)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -380,33 +511,19 @@ int CLunaticoBeaver::getDomeHomeAz(double &dAz)
     
     nErr = domeCommand("!domerot gethome#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeHomeAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeHomeAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
     
     // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            dAz = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeHomeAz] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, dAz);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeHomeAz] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
     }
 
     m_dHomeAz = dAz;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeHomeAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dHomeAz << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeHomeAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dHomeAz << std::endl;
 
     return nErr;
 }
@@ -415,7 +532,6 @@ int CLunaticoBeaver::getDomeParkAz(double &dAz)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -427,32 +543,18 @@ int CLunaticoBeaver::getDomeParkAz(double &dAz)
 
     nErr = domeCommand("!domerot getpark#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeParkAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeParkAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
     // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            dAz = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeParkAz] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, dAz);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeParkAz] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
     }
     m_dParkAz = dAz;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeParkAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dHomeAz << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeParkAz] Dome Az  : " << std::fixed << std::setprecision(2) << m_dHomeAz << std::endl;
 
     return nErr;
 }
@@ -461,8 +563,7 @@ int CLunaticoBeaver::getDomeParkAz(double &dAz)
 int CLunaticoBeaver::getShutterState(int &nState)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> shutterStateFileds;
+    DomeStatus Status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -475,52 +576,28 @@ int CLunaticoBeaver::getShutterState(int &nState)
     if(m_bCalibrating)
         return nErr;
 
-	
     nState = SHUTTER_ERROR;
-    
-    nErr = domeCommand("!dome shutterstatus#", sResp);
+
+    // the shutter state is part of the status bitfield, no need for a "!dome shutterstatus#" round trip
+    nErr = getDomeStatus(Status);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterState] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterState] ERROR : " << nErr << std::endl;
         return nErr;
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterState] sResp : " << sResp << std::endl;
-    m_sLogFile.flush();
-#endif
-
-    parseFields(sResp, shutterStateFileds, ':');
-    if(shutterStateFileds.size()>=2) {
-        try {
-            nState = std::stoi(shutterStateFileds[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterState] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-    }
-
+    nState = Status.nShutterState;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterState] nState : " << nState << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterState] nState : " << nState << std::endl;
 
     return nErr;
 }
 
 
+// Served from the battery cache, which the status poller keeps fresh. The shutter is
+// only asked when the cache is older than BATTERY_MAX_AGE or the cutoff isn't known.
 int CLunaticoBeaver::getBatteryLevels(double &dShutterVolts, double &dShutterCutOff)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -531,61 +608,100 @@ int CLunaticoBeaver::getBatteryLevels(double &dShutterVolts, double &dShutterCut
     dShutterVolts  = 0;
     dShutterCutOff = 0;
     if(m_bShutterPresent) {
-        nErr = shutterCommand("shutter getvoltage", sResp);
+        if(m_BatteryCache.Get(dShutterVolts, dShutterCutOff, steadyNow(), BATTERY_MAX_AGE))
+            return nErr;
+        nErr = refreshBatteryLevels();
+        m_BatteryCache.Get(dShutterVolts, dShutterCutOff, steadyNow(), BATTERY_MAX_AGE);
+        // over the shutter link budget an old reading is better than none
+        if(nErr == SHUTTER_LINK_BUSY && dShutterVolts != 0)
+            nErr = PLUGIN_OK;
         if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getBatteryLevels] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-            m_sLogFile.flush();
-#endif
+            PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getBatteryLevels] ERROR : " << nErr << std::endl;
             return nErr;
         }
-        
-        parseFields(sResp, svFields, ':');
-        if(svFields.size()>=2) {
-            try {
-                dShutterVolts = std::stof(svFields[1]);
-            }
-            catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getBatteryLevels] conversion exception : " << e.what() << std::endl;
-                m_sLogFile.flush();
-#endif
-                return ERR_CMDFAILED;
-            }
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getBatteryLevels] dShutterVolts  : " << std::fixed << std::setprecision(2) << dShutterVolts << std::endl;
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getBatteryLevels] dShutterCutOff : " << std::fixed << std::setprecision(2) << dShutterCutOff << std::endl;
+    }
+    return nErr;
+}
 
-        }
+// Callers asking while a refresh is in flight wait for it, its readings are theirs.
+int CLunaticoBeaver::refreshBatteryLevels(bool bDroppable)
+{
+    int nErr = PLUGIN_OK;
+    std::string sUnused;
 
-        nErr = shutterCommand("shutter getsafevoltage", sResp);
-        if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getBatteryLevels] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-            m_sLogFile.flush();
-#endif
-            return nErr;
-        }
-        
-        parseFields(sResp, svFields, ':');
-        if(svFields.size()>=2) {
-            try {
-                dShutterCutOff = std::stof(svFields[1]);
-            }
-            catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getBatteryLevels] conversion exception : " << e.what() << std::endl;
-                m_sLogFile.flush();
-#endif
-                return ERR_CMDFAILED;
-            }
-        }
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeParkAz] dShutterVolts  : " << std::fixed << std::setprecision(2) << dShutterVolts << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeParkAz] dShutterCutOff : " << std::fixed << std::setprecision(2) << dShutterCutOff << std::endl;
-        m_sLogFile.flush();
-#endif
+    if(!m_ShutterLink.BeginQuery("battery levels", sUnused, nErr))
+        return nErr;
+    nErr = readBatteryLevels(bDroppable);
+    m_ShutterLink.EndQuery("battery levels", sUnused, nErr);
+    return nErr;
+}
+
+// Reads what the battery cache is missing : the voltage if it's older than the refresh
+// interval, the cutoff until we have a good one. Each is a relay round trip to the shutter.
+int CLunaticoBeaver::readBatteryLevels(bool bDroppable)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> svCmds;
+    std::vector<std::string> svResps;
+    unsigned int nGeneration;
+    long long nSampleTime;
+    bool bReadVolts;
+    bool bReadCutOff;
+    double dShutterVolts = 0;
+    double dShutterCutOff = 0;
+
+    nSampleTime = steadyNow();
+    nGeneration = m_BatteryCache.GetCutOffGeneration();
+    bReadCutOff = !m_BatteryCache.HasCutOff();
+    bReadVolts = !m_BatteryCache.HasVolts(nSampleTime, BATTERY_REFRESH_INTERVAL) || !bReadCutOff;
+    if(bReadVolts)
+        svCmds.push_back("!dome sendtoshutter \"shutter getvoltage\"#");
+    if(bReadCutOff)
+        svCmds.push_back("!dome sendtoshutter \"shutter getsafevoltage\"#");
+
+    nErr = domeCommandBatch(svCmds, svResps, MAX_TIMEOUT, false, bDroppable);
+    if(nErr)
+        return nErr;
+    if((bReadVolts && parseValue(svResps.front(), dShutterVolts)) || (bReadCutOff && parseValue(svResps.back(), dShutterCutOff))) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [refreshBatteryLevels] conversion error : " << svResps.front() << " " << svResps.back() << std::endl;
+        return ERR_CMDFAILED;
     }
+
+    if(bReadVolts)
+        m_BatteryCache.SetVolts(dShutterVolts, nSampleTime);
+    if(bReadCutOff)
+        m_BatteryCache.SetCutOff(dShutterCutOff, nGeneration);
+    m_BatteryCache.Get(dShutterVolts, dShutterCutOff, nSampleTime, BATTERY_MAX_AGE);
+    updateTelemetryBattery(dShutterVolts, dShutterCutOff);
     return nErr;
 }
 
+// Status poller thread. Waits for the dome and the shutter to stop, so the slow
+// relayed queries don't delay the status samples of a move.
+void CLunaticoBeaver::checkBatteryRefresh(int nStatus)
+{
+    double dShutterVolts;
+    double dShutterCutOff;
+    long long nNow;
+
+    if(!m_bShutterPresent || m_bCalibrating || (nStatus & (DOME_MOVING | SHUTTER_MOVING)))
+        return;
+
+    nNow = steadyNow();
+    // a command may have just read it, and a failed read isn't retried before the interval
+    if(m_BatteryCache.Get(dShutterVolts, dShutterCutOff, nNow, BATTERY_REFRESH_INTERVAL))
+        return;
+    if(m_nBatteryRefreshTime && nNow - m_nBatteryRefreshTime < BATTERY_REFRESH_INTERVAL * 1000000LL)
+        return;
+    m_nBatteryRefreshTime = nNow;
+
+    if(refreshBatteryLevels(true)) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [checkBatteryRefresh] battery read failed, next try in " << BATTERY_REFRESH_INTERVAL << " ms" << std::endl;
+    }
+}
+
 int CLunaticoBeaver::setBatteryCutOff(double dShutterCutOff)
 {
     int nErr = PLUGIN_OK;
@@ -597,26 +713,25 @@ int CLunaticoBeaver::setBatteryCutOff(double dShutterCutOff)
     
     ssTmp<<"shutter setsafevoltage " << dShutterCutOff;
     nErr = shutterCommand(ssTmp.str(), sResp);
+    // read back what the shutter kept, even if we don't know whether the command made it
+    m_BatteryCache.InvalidateCutOff();
     return nErr;
 }
 
 bool CLunaticoBeaver::isDomeMoving()
 {
-    bool bIsMoving = false;
-    int nTmp;
-    
-    getDomeStatus(nTmp);
+    DomeStatus Status;
 
-    bIsMoving = ((nTmp & DOME_MOVING) == DOME_MOVING);
+    if(getDomeStatus(Status))
+        return false;
 
-    return bIsMoving;
+    return Status.bDomeMoving;
 }
 
 int CLunaticoBeaver::getDomeStatus(int &nStatus)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
     
     nStatus = 0;
     if(!m_bIsConnected)
@@ -627,48 +742,89 @@ int CLunaticoBeaver::getDomeStatus(int &nStatus)
 
     nErr = domeCommand("!dome status#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
     // need to parse sResp
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=1) {
-        try {
-            nStatus = std::stoi(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, nStatus);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
     }
 
     m_nDomeRotStatus = nStatus & DOME_STATUS_MASK;
 //    m_nShutStatus = nStatus & SHUTTER_STATUS_MASK;
     m_nRainSensorstate = ((nStatus & RAIN_SENSOR_MASK) != 0 ? RAINING : NOT_RAINING);
+    // the poller publishes its own samples
+    if(!m_bPollerRunning)
+        updateTelemetryStatus(nStatus, m_dCurrentAzPosition);
     
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] nStatus            : " << nStatus << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] m_nDomeRotStatus   : " << m_nDomeRotStatus << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] m_nRainSensorstate : " << m_nRainSensorstate << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStatus] m_nRainSensorstate : " << (m_nRainSensorstate==RAINING?"Raining":"Not Raining") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getDomeStatus] nStatus            : " << nStatus << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getDomeStatus] m_nDomeRotStatus   : " << m_nDomeRotStatus << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getDomeStatus] m_nRainSensorstate : " << m_nRainSensorstate << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getDomeStatus] m_nRainSensorstate : " << (m_nRainSensorstate==RAINING?"Raining":"Not Raining") << std::endl;
     
     return nErr;
 }
 
+// Decoded status, from the poller snapshot when it is fresh, otherwise from a single "!dome status#" read.
+int CLunaticoBeaver::getDomeStatus(DomeStatus &Status)
+{
+    int nErr = PLUGIN_OK;
+    int nStatus;
+    double dAz;
+
+    if(getStatusSnapshot(nStatus, dAz)) {
+        m_nDomeRotStatus = nStatus & DOME_STATUS_MASK;
+        m_nRainSensorstate = ((nStatus & RAIN_SENSOR_MASK) != 0 ? RAINING : NOT_RAINING);
+    }
+    else {
+        nErr = getDomeStatus(nStatus);
+        if(nErr)
+            return nErr;
+    }
+
+    decodeDomeStatus(nStatus, Status);
+
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] nRaw          : " << Status.nRaw << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] bDomeMoving   : " << (Status.bDomeMoving?"Yes":"No") << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] nShutterState : " << Status.nShutterState << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] bAtHome       : " << (Status.bAtHome?"Yes":"No") << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStatus] bAtPark       : " << (Status.bAtPark?"Yes":"No") << std::endl;
+
+    return nErr;
+}
+
+void CLunaticoBeaver::decodeDomeStatus(int nStatus, DomeStatus &Status)
+{
+    Status.nRaw = nStatus;
+    Status.bDomeMoving = (nStatus & DOME_MOVING) != 0;
+    Status.bShutterMoving = (nStatus & SHUTTER_MOVING) != 0;
+    Status.bDomeMechError = (nStatus & DOME_MECH_ERROR) != 0;
+    Status.bShutterMechError = (nStatus & SHUTTER_MECH_ERROR) != 0;
+    Status.bShutterComError = (nStatus & SHUTTER_COM_ERROR) != 0;
+    Status.bRaining = (nStatus & RAIN_SENSOR_MASK) != 0;
+    Status.bAtHome = (nStatus & DOME_AT_HOME) != 0;
+    Status.bAtPark = (nStatus & DOME_AT_PARK) != 0;
+
+    // moving states first, the controller may still report the previous end position
+    if(nStatus & SHUTTER_OPENING)
+        Status.nShutterState = OPENING;
+    else if(nStatus & SHUTTER_CLOSING)
+        Status.nShutterState = CLOSING;
+    else if(nStatus & SHUTTER_OPEN)
+        Status.nShutterState = OPEN;
+    else if(nStatus & SHUTTER_CLOSED)
+        Status.nShutterState = CLOSED;
+    else
+        Status.nShutterState = SHUTTER_ERROR;
+}
+
 int CLunaticoBeaver::setMaxRotationTime(int nSeconds)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -678,10 +834,7 @@ int CLunaticoBeaver::setMaxRotationTime(int nSeconds)
 
     nErr = domeCommand("!domerot setmaxfullrotsecs 300#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setMaxRotationTime] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [setMaxRotationTime] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return false;
     }
 
@@ -692,54 +845,20 @@ int CLunaticoBeaver::setMaxRotationTime(int nSeconds)
 
 bool CLunaticoBeaver::isDomeAtHome()
 {
-    bool bAthome;
-    int nTmp;
-    int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> svFields;
-    
+    DomeStatus Status;
+
     if(!m_bIsConnected)
-        return NOT_CONNECTED;
+        return false;
 
     if(m_bCalibrating)
-        return nErr;
-
-    nErr = domeCommand("!dome athome#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isDomeAtHome] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
         return false;
-    }
 
-    bAthome = false;
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=1) {
-        try {
-            nTmp = std::stoi(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isDomeAtHome] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-    }
-    else
-        nTmp = 0;
-
-    if(nTmp == AT_HOME)
-        bAthome = true;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isDomeAtHome] nTmp    : " << m_nDomeRotStatus << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isDomeAtHome] bAthome : " << (bAthome?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    if(getDomeStatus(Status))
+        return false;
 
-    return bAthome;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isDomeAtHome] bAthome : " << (Status.bAtHome?"Yes":"No") << std::endl;
 
+    return Status.bAtHome;
 }
 
 int CLunaticoBeaver::syncDome(double dAz, double dEl)
@@ -757,11 +876,14 @@ int CLunaticoBeaver::syncDome(double dAz, double dEl)
     m_dCurrentAzPosition = dAz;
     ssTmp << "!dome setaz " << std::fixed << std::setprecision(2) << dAz << "#";
     nErr = domeCommand(ssTmp.str(), sResp);
+    markStateChanged();
+    setMotionPosition(dAz);
+    {
+        std::lock_guard<std::mutex> lock(m_DeadbandMutex);
+        m_TrackingDeadband.Reset();
+    }
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [syncDome] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [syncDome] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
     // TODO : Also set Elevation when supported by the firmware.
@@ -783,8 +905,15 @@ int CLunaticoBeaver::parkDome()
     if(m_bHomeOnPark) {
         m_bParking = true;
         nErr = goHome();
+        if(!nErr)
+            startMoveETA(MOVE_PARK, -1);
     } else {
         nErr = domeCommand("!dome gopark#", sResp);
+        markStateChanged();
+        if(!nErr) {
+            setMotionTarget(m_dParkAz);
+            startMoveETA(MOVE_PARK, getMotionTime());
+        }
     }
     return nErr;
 
@@ -797,10 +926,7 @@ int CLunaticoBeaver::unparkDome()
         goHome();
     }
     else {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [unparkDome] m_dParkAz : " << std::fixed << std::setprecision(2) << m_dParkAz << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [unparkDome] m_dParkAz : " << std::fixed << std::setprecision(2) << m_dParkAz << std::endl;
         syncDome(m_dParkAz, m_dCurrentElPosition);
         m_bParked = false;
         m_bUnParking = false;
@@ -812,8 +938,10 @@ int CLunaticoBeaver::unparkDome()
 int CLunaticoBeaver::gotoAzimuth(double dNewAz)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::stringstream ssTmp;
+    double dDomeAz;
+    double dGotoAz;
+    bool bPending;
+    bool bSend;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -824,27 +952,128 @@ int CLunaticoBeaver::gotoAzimuth(double dNewAz)
     while(dNewAz >= 360)
         dNewAz = dNewAz - 360;
 
-    ssTmp<<"!dome gotoaz " << dNewAz << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [gotoAzimuth] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+    // compare with where the dome is going if a goto is still in progress
+    {
+        std::lock_guard<std::mutex> lock(m_ETAMutex);
+        bPending = m_MoveETA[MOVE_GOTO].IsActive();
+    }
+    if(bPending)
+        dDomeAz = m_dGotoAz;
+    else if(!getPredictedAz(dDomeAz))
+        dDomeAz = m_dCurrentAzPosition;
+    {
+        std::lock_guard<std::mutex> lock(m_DeadbandMutex);
+        bSend = m_TrackingDeadband.Filter(dDomeAz, dNewAz, dGotoAz);
+    }
+    if(!bSend) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [gotoAzimuth] " << std::fixed << std::setprecision(2) << dNewAz << " within the deadband of " << dDomeAz << std::endl;
+        // nothing to wait for, unless the dome is still on its way
+        m_bGotoAbsorbed = !bPending;
+        m_bGotoCancelled = false;
         return nErr;
     }
+    if(dGotoAz != dNewAz) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [gotoAzimuth] tracking " << std::fixed << std::setprecision(2) << dNewAz << " , leading to " << dGotoAz << std::endl;
+    }
 
-    m_dGotoAz = dNewAz;
-    m_nGotoTries = 0;
-    return nErr;
+    return startGoto(dGotoAz);
 }
 
-int CLunaticoBeaver::openShutter()
+int CLunaticoBeaver::startGoto(double dNewAz, bool bRetry)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    double dShutterVolts;
-    double dShutterCutOff;
+    double dStartAz;
+    SlewPlan Plan;
+
+    m_bGotoAbsorbed = false;
+    if(!getPredictedAz(dStartAz))
+        dStartAz = m_dCurrentAzPosition;
+    planSlew(dStartAz, dNewAz, Plan);
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [startGoto] from " << std::fixed << std::setprecision(2) << dStartAz << " to " << dNewAz << " : " << Plan.dDistance << " deg " << (Plan.nDirection > 0 ? "CW" : "CCW") << " , " << Plan.dTime << " s" << (Plan.bMerge ? " , merged with the pending goto" : "") << std::endl;
+    if(Plan.bVia) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [startGoto] long way round, via " << std::fixed << std::setprecision(2) << Plan.dViaAz << std::endl;
+    }
+    if(Plan.bMerge)
+        return nErr;
+
+    nErr = sendGotoAz(Plan.bVia ? Plan.dViaAz : dNewAz);
+    if(nErr)
+        return nErr;
+
+    m_dGotoAz = dNewAz;
+    m_bGotoVia = Plan.bVia;
+    m_nGotoDirection = Plan.nDirection;
+    if(!bRetry) {
+        m_nGotoTries = 0;
+        m_bGotoCancelled = false;
+        // remembered to learn the goto tolerance once we get there
+        m_dGotoDistance = Plan.dDistance;
+        std::lock_guard<std::mutex> lock(m_MotionMutex);
+        m_dGotoSpeed = m_MotionModel.GetMaxSpeed();
+    }
+    setMotionTarget(Plan.bVia ? Plan.dViaAz : dNewAz);
+    startMoveETA(MOVE_GOTO, Plan.dTime);
+    return nErr;
+}
+
+int CLunaticoBeaver::sendGotoAz(double dAz)
+{
+    int nErr;
+    std::string sResp;
+    std::stringstream ssTmp;
+
+    ssTmp<<"!dome gotoaz " << dAz << "#";
+    nErr = domeCommand(ssTmp.str(), sResp);
+    markStateChanged();
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [sendGotoAz] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
+    }
+    return nErr;
+}
+
+void CLunaticoBeaver::planSlew(double dFromAz, double dToAz, SlewPlan &Plan)
+{
+    bool bPending;
+    double dMergeTolerance;
+
+    // a new target within half the goto tolerance of where the dome is already going
+    // would end up within the tolerance anyway.
+    dMergeTolerance = m_GotoTolerance.Get(m_dGotoDistance, m_dGotoSpeed) / 2.0;
+    {
+        std::lock_guard<std::mutex> lock(m_ETAMutex);
+        bPending = m_MoveETA[MOVE_GOTO].IsActive();
+    }
+
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    bPending = bPending && m_MotionModel.IsMoving();
+    CSlewPlanner::Plan(m_MotionModel, dFromAz, dToAz, bPending, m_dGotoAz, dMergeTolerance, Plan);
+}
+
+// going the long way round, send the real target once the controller's shortest way
+// to it is the way we're going, or right away if the dome already stopped at the via point.
+void CLunaticoBeaver::checkGotoVia(bool bStopped)
+{
+    double dAz;
+
+    if(!m_bGotoVia)
+        return;
+    if(!getPredictedAz(dAz))
+        dAz = m_dCurrentAzPosition;
+    if(!bStopped && !CSlewPlanner::IsTargetAhead(dAz, m_dGotoAz, m_nGotoDirection))
+        return;
+
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [checkGotoVia] at " << std::fixed << std::setprecision(2) << dAz << " , now going to " << m_dGotoAz << std::endl;
+    m_bGotoVia = false;
+    if(!sendGotoAz(m_dGotoAz))
+        setMotionTarget(m_dGotoAz);
+}
+
+int CLunaticoBeaver::openShutter()
+{
+    int nErr = PLUGIN_OK;
+    std::string sResp;
+    double dShutterVolts;
+    double dShutterCutOff;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -852,28 +1081,28 @@ int CLunaticoBeaver::openShutter()
     if(m_bCalibrating)
         return nErr;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [openShutter] m_bShutterPresent : " << (m_bShutterPresent?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [openShutter] m_bShutterPresent : " << (m_bShutterPresent?"Yes":"No") << std::endl;
     if(!m_bShutterPresent) {
         return SB_OK;
     }
 
-    getBatteryLevels(dShutterVolts, dShutterCutOff);
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [openShutter] Opening shutter." << std::endl;
-    m_sLogFile.flush();
-#endif
+    // only ask the shutter if the background refresh hasn't read the voltage lately
+    if(!m_BatteryCache.HasVolts(steadyNow(), BATTERY_OPEN_MAX_AGE))
+        refreshBatteryLevels();
+    m_BatteryCache.Get(dShutterVolts, dShutterCutOff, steadyNow(), BATTERY_OPEN_MAX_AGE);
+    if(dShutterCutOff > 0 && dShutterVolts < dShutterCutOff) {
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [openShutter] shutter battery at " << std::fixed << std::setprecision(2) << dShutterVolts << " V, below the " << dShutterCutOff << " V cutoff" << std::endl;
+    }
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [openShutter] Opening shutter." << std::endl;
 
 	
     nErr = domeCommand("!dome openshutter#", sResp);
+    markStateChanged();
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [openShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [openShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
     }
+    else
+        startMoveETA(MOVE_OPEN, -1);
     return nErr;
 }
 
@@ -881,8 +1110,6 @@ int CLunaticoBeaver::closeShutter()
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    double dShutterVolts;
-    double dShutterCutOff;
     
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -890,30 +1117,22 @@ int CLunaticoBeaver::closeShutter()
     if(m_bCalibrating)
         return nErr;
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [closeShutter] m_bShutterPresent : " << (m_bShutterPresent?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [closeShutter] m_bShutterPresent : " << (m_bShutterPresent?"Yes":"No") << std::endl;
 
     if(!m_bShutterPresent) {
         return SB_OK;
     }
 
-    getBatteryLevels(dShutterVolts, dShutterCutOff);
-
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [closeShutter] Closing shutter." << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [closeShutter] Closing shutter." << std::endl;
 
 	
     nErr = domeCommand("!dome closeshutter#", sResp);
+    markStateChanged();
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [closeShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [closeShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
     }
+    else
+        startMoveETA(MOVE_CLOSE, -1);
 
     return nErr;
 }
@@ -922,9 +1141,9 @@ int CLunaticoBeaver::getFirmwareVersion(std::string &sVersion)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> firmwareFields;
-    std::vector<std::string> versionFields;
-    std::string strVersion;
+    const char *pszField;
+    size_t nFieldLen;
+    char szVersion[16];
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -935,34 +1154,22 @@ int CLunaticoBeaver::getFirmwareVersion(std::string &sVersion)
     sVersion.clear();
     nErr = domeCommand("!seletek version#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFirmwareVersion] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getFirmwareVersion] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
-    nErr = parseFields(sResp, firmwareFields, ':');
+    nErr = getResponseField(sResp, pszField, nFieldLen);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFirmwareVersion] parsing error : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getFirmwareVersion] parsing error : " << nErr << std::endl;
         return ERR_CMDFAILED;
     }
 
-    if(firmwareFields.size()>=2) {
-        std::stringstream ssTmp;
-        if(firmwareFields[1].size()>=3) {
-            ssTmp << firmwareFields[1].at(1) << "." << firmwareFields[1].at(2) << "." << firmwareFields[1].at(3);
-            sVersion.assign(ssTmp.str());
-        }
+    if(nFieldLen>=4) {
+        snprintf(szVersion, sizeof(szVersion), "%c.%c.%c", pszField[1], pszField[2], pszField[3]);
+        sVersion.assign(szVersion);
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFirmwareVersion] firmware : " << sVersion << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getFirmwareVersion] firmware : " << sVersion << std::endl;
 
     return nErr;
 }
@@ -972,9 +1179,9 @@ int CLunaticoBeaver::getShutterFirmwareVersion(std::string &sVersion)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> firmwareFields;
-    std::vector<std::string> versionFields;
-    std::string strVersion;
+    const char *pszField;
+    size_t nFieldLen;
+    char szVersion[16];
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -985,29 +1192,20 @@ int CLunaticoBeaver::getShutterFirmwareVersion(std::string &sVersion)
     sVersion.clear();
     nErr = shutterCommand("seletek version", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterFirmwareVersion] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterFirmwareVersion] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
-    nErr = parseFields(sResp, firmwareFields, ':');
+    nErr = getResponseField(sResp, pszField, nFieldLen);
     if(nErr) {
         return ERR_CMDFAILED;
     }
-    if(firmwareFields.size()>=2) {
-        std::stringstream ssTmp;
-        if(firmwareFields[1].size()>=3) {
-            ssTmp << firmwareFields[1].at(1) << "." << firmwareFields[1].at(2) << "." << firmwareFields[1].at(3);
-            sVersion.assign(ssTmp.str());
-        }
+    if(nFieldLen>=4) {
+        snprintf(szVersion, sizeof(szVersion), "%c.%c.%c", pszField[1], pszField[2], pszField[3]);
+        sVersion.assign(szVersion);
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterFirmwareVersion] Shutter firmware : " << sVersion << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterFirmwareVersion] Shutter firmware : " << sVersion << std::endl;
 
     return nErr;
 }
@@ -1027,21 +1225,17 @@ int CLunaticoBeaver::goHome()
     if(isDomeAtHome()){
             return PLUGIN_OK;
     }
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [goHome]" << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [goHome]" << std::endl;
 
     m_nHomingTries = 0;
     nErr = domeCommand("!dome gohome 300#", sResp);
+    markStateChanged();
     if(nErr) {
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [goHome] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [goHome] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
+    setMotionTarget(m_dHomeAz);
     return nErr;
 }
 
@@ -1057,11 +1251,9 @@ int CLunaticoBeaver::calibrateDome()
         return nErr;
 
     nErr = domeCommand("!domerot calibrate 2 300#", sResp); // 5 minute timeout .. to be on the safe side
+    markStateChanged();
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [calibrate] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [calibrate] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
     m_bCalibrating = true;
@@ -1081,11 +1273,9 @@ int CLunaticoBeaver::calibrateShutter()
         return nErr;
 
     nErr = domeCommand("!dome autocalshutter#", sResp);
+    markStateChanged();
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [calibrateShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [calibrateShutter] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
         return nErr;
     }
 
@@ -1097,94 +1287,90 @@ int CLunaticoBeaver::isGoToComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
     double dDomeAz = 0;
+    bool bOnTarget;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete]" << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete]" << std::endl;
 
     bComplete = false;
+    if(m_bGotoCancelled) {
+        // the rain reaction sent the dome home or to park
+        m_bGotoCancelled = false;
+        m_bGotoVia = false;
+        m_nGotoTries = 0;
+        PLUGIN_LOG(LOG_INFO, LOG_RAIN) << " [isGoToComplete] goto to " << std::fixed << std::setprecision(2) << m_dGotoAz << " cancelled by the rain reaction" << std::endl;
+        return ERR_CMDFAILED;
+    }
+    if(m_bGotoAbsorbed) {
+        // the dome didn't need to move
+        m_bGotoAbsorbed = false;
+        bComplete = true;
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] goto absorbed by the deadband" << std::endl;
+        return nErr;
+    }
+    checkGotoVia(false);
+    if(!isMoveCheckDue(MOVE_GOTO))
+        return nErr;
+
     if(isDomeMoving()) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete] Dome is still moving" << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] Dome is still moving" << std::endl;
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
+        scheduleMoveCheck(MOVE_GOTO);
+        return nErr;
+    }
+
+    if(m_bGotoVia) {
+        // stopped at the via point
+        checkGotoVia(true);
         return nErr;
     }
 
     getDomeAz(dDomeAz);
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete] dDomeAz : "  << std::fixed << std::setprecision(2) << dDomeAz << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete] m_dGotoAz : "  << std::fixed << std::setprecision(2) << m_dGotoAz << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] dDomeAz : "  << std::fixed << std::setprecision(2) << dDomeAz << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] m_dGotoAz : "  << std::fixed << std::setprecision(2) << m_dGotoAz << std::endl;
 
-    if(checkBoundaries(m_dGotoAz, dDomeAz)) {
+    // judged against what we knew before this goto, so a miss can't widen the tolerance that judges it
+    bOnTarget = checkBoundaries(m_dGotoAz, dDomeAz, m_GotoTolerance.Get(m_dGotoDistance, m_dGotoSpeed));
+    // only the first attempt, a retry is a short correction that says little about the dome
+    if(m_nGotoTries == 0)
+        m_GotoTolerance.Add(m_dGotoDistance, m_dGotoSpeed, CDomeMotionModel::AngleDiff(m_dGotoAz, dDomeAz));
+
+    if(bOnTarget) {
         bComplete = true;
         m_nGotoTries = 0;
+        completeMoveETA(MOVE_GOTO);
     }
     else {
         // we're not moving and we're not at the final destination !!!
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete]  ***** ERROR **** domeAz =  dDomeAz : "  << std::fixed << std::setprecision(2) << dDomeAz << " , m_dGotoAz : "  << std::fixed << std::setprecision(2) << m_dGotoAz << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete]  ***** ERROR **** domeAz =  dDomeAz : "  << std::fixed << std::setprecision(2) << dDomeAz << " , m_dGotoAz : "  << std::fixed << std::setprecision(2) << m_dGotoAz << std::endl;
         if(m_nGotoTries == 0) {
             bComplete = false;
             m_nGotoTries = 1;
-            gotoAzimuth(m_dGotoAz);
+            stopMoveETA(MOVE_GOTO);    // the dome stopped, nothing pending to merge with
+            startGoto(m_dGotoAz, true);
         }
         else {
             m_nGotoTries = 0;
             nErr = ERR_CMDFAILED;
+            stopMoveETA(MOVE_GOTO);
         }
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isGoToComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isGoToComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
 
     return nErr;
 }
 
-bool CLunaticoBeaver::checkBoundaries(double dGotoAz, double dDomeAz)
+bool CLunaticoBeaver::checkBoundaries(double dGotoAz, double dDomeAz, double dTolerance)
 {
-    double highMark;
-    double lowMark;
-    double roundedGotoAz;
-
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [checkBoundaries]" << std::endl;
-    m_sLogFile.flush();
-#endif
-
-    // we need to test "large" depending on the heading error and movement coasting
-    highMark = ceil(dDomeAz)+2;
-    lowMark = ceil(dDomeAz)-2;
-    roundedGotoAz = ceil(dGotoAz);
+    double dError;
 
-    if(lowMark < 0 && highMark>0) { // we're close to 0 degre but above 0
-        if((roundedGotoAz+2) >= 360)
-            roundedGotoAz = (roundedGotoAz+2)-360;
-        if ( (roundedGotoAz > lowMark) && (roundedGotoAz <= highMark)) {
-            return true;
-        }
-    }
-    if ( lowMark > 0 && highMark>360 ) { // we're close to 0 but from the other side
-        if( (roundedGotoAz+360) > lowMark && (roundedGotoAz+360) <= highMark) {
-            return true;
-        }
-    }
-    if (roundedGotoAz > lowMark && roundedGotoAz <= highMark) {
-        return true;
-    }
+    dError = fabs(CDomeMotionModel::AngleDiff(dGotoAz, dDomeAz));
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [checkBoundaries] error : " << std::fixed << std::setprecision(2) << dError << " , tolerance : " << dTolerance << std::endl;
 
-    return false;
+    return dError <= dTolerance;
 }
 
 
@@ -1204,24 +1390,28 @@ int CLunaticoBeaver::isOpenComplete(bool &bComplete)
         return SB_OK;
     }
 
+    if(!isMoveCheckDue(MOVE_OPEN)) {
+        bComplete = false;
+        return nErr;
+    }
+
     nErr = getShutterState(nState);
     if(nErr)
         return ERR_CMDFAILED;
     if(nState == OPEN){
         m_bShutterOpened = true;
         bComplete = true;
+        completeMoveETA(MOVE_OPEN);
         m_dCurrentElPosition = 90.0;
     }
     else {
         m_bShutterOpened = false;
         bComplete = false;
+        scheduleMoveCheck(MOVE_OPEN);
         m_dCurrentElPosition = 0.0;
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isOpenComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isOpenComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
 
     return nErr;
 }
@@ -1242,24 +1432,28 @@ int CLunaticoBeaver::isCloseComplete(bool &bComplete)
         return SB_OK;
     }
 
+    if(!isMoveCheckDue(MOVE_CLOSE)) {
+        bComplete = false;
+        return nErr;
+    }
+
     nErr = getShutterState(nState);
     if(nErr)
         return ERR_CMDFAILED;
     if(nState == CLOSED){
         m_bShutterOpened = false;
         bComplete = true;
+        completeMoveETA(MOVE_CLOSE);
         m_dCurrentElPosition = 0.0;
     }
     else {
         m_bShutterOpened = true;
         bComplete = false;
+        scheduleMoveCheck(MOVE_CLOSE);
         m_dCurrentElPosition = 90.0;
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCloseComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isCloseComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
 
     return nErr;
 }
@@ -1271,21 +1465,29 @@ int CLunaticoBeaver::isParkComplete(bool &bComplete)
     double dDomeAz=0;
     bool bFoundHome;
     std::string sResp;
+    DomeStatus Status;
 
     if(m_bCalibrating)
         return nErr;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isParkComplete] m_bParking : " << (m_bParking?"True":"False") << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isParkComplete] bComplete  : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isParkComplete] m_bParking : " << (m_bParking?"True":"False") << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isParkComplete] bComplete  : " << (bComplete?"True":"False") << std::endl;
 
-    if(isDomeMoving()) {
+    if(!isMoveCheckDue(MOVE_PARK)) {
+        bComplete = false;
+        return nErr;
+    }
+
+    nErr = getDomeStatus(Status);
+    if(nErr)
+        return nErr;
+
+    if(Status.bDomeMoving) {
         getDomeAz(dDomeAz);
         bComplete = false;
+        scheduleMoveCheck(MOVE_PARK);
         return nErr;
     }
 
@@ -1293,33 +1495,33 @@ int CLunaticoBeaver::isParkComplete(bool &bComplete)
         bComplete = false;
         nErr = isFindHomeComplete(bFoundHome);
         if(bFoundHome) { // we're home, now park
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isParkComplete] found home, now parking." << std::endl;
-            m_sLogFile.flush();
-#endif
+            PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isParkComplete] found home, now parking." << std::endl;
             m_bParking = false;
             nErr = domeCommand("!dome gopark#", sResp);
+            markStateChanged();
+            if(!nErr)
+                setMotionTarget(m_dParkAz);
         }
+        scheduleMoveCheck(MOVE_PARK);
         return nErr;
     }
 
     getDomeAz(dDomeAz);
 
-    if(checkBoundaries(m_dParkAz, dDomeAz)) {
+    if(Status.bAtPark || checkBoundaries(m_dParkAz, dDomeAz, m_GotoTolerance.GetOverall())) {
         m_bParked = true;
         bComplete = true;
+        completeMoveETA(MOVE_PARK);
     }
     else {
         // we're not moving and we're not at the final destination !!!
         bComplete = false;
         m_bParked = false;
         nErr = ERR_CMDFAILED;
+        stopMoveETA(MOVE_PARK);
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isParkComplete] bComplete  : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isParkComplete] bComplete  : " << (bComplete?"True":"False") << std::endl;
 
     return nErr;
 }
@@ -1338,16 +1540,10 @@ int CLunaticoBeaver::isUnparkComplete(bool &bComplete)
 
     if(!m_bParked) {
         bComplete = true;
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isUnparkComplete] Unparked." << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isUnparkComplete] Unparked." << std::endl;
     }
     else if (m_bUnParking) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isUnparkComplete] unparking.. checking if we're home." << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isUnparkComplete] unparking.. checking if we're home." << std::endl;
         nErr = isFindHomeComplete(bComplete);
         if(nErr)
             return nErr;
@@ -1359,11 +1555,8 @@ int CLunaticoBeaver::isUnparkComplete(bool &bComplete)
         }
     }
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isUnparkComplete] m_bParked : " << (m_bParked?"True":"False") << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isUnparkComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isUnparkComplete] m_bParked : " << (m_bParked?"True":"False") << std::endl;
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isUnparkComplete] bComplete : " << (bComplete?"True":"False") << std::endl;
 
     return nErr;
 }
@@ -1371,6 +1564,7 @@ int CLunaticoBeaver::isUnparkComplete(bool &bComplete)
 int CLunaticoBeaver::isFindHomeComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
+    DomeStatus Status;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1378,38 +1572,31 @@ int CLunaticoBeaver::isFindHomeComplete(bool &bComplete)
     if(m_bCalibrating)
         return nErr;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isFindHomeComplete]" << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isFindHomeComplete]" << std::endl;
 
-    if(isDomeMoving()) {
+    // moving and at home come from the same status read
+    nErr = getDomeStatus(Status);
+    if(nErr)
+        return nErr;
+
+    if(Status.bDomeMoving) {
         bComplete = false;
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isFindHomeComplete] still moving." << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isFindHomeComplete] still moving." << std::endl;
         return nErr;
 
     }
 
-    if(isDomeAtHome()){
+    if(Status.bAtHome){
         bComplete = true;
         if(m_bUnParking)
             m_bParked = false;
         syncDome(m_dHomeAz, m_dCurrentElPosition);
         m_nHomingTries = 0;
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isFindHomeComplete] At Home." << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isFindHomeComplete] At Home." << std::endl;
     }
     else {
         // we're not moving and we're not at the home position !!!
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isFindHomeComplete] Not moving and not at home !!!" << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isFindHomeComplete] Not moving and not at home !!!" << std::endl;
         bComplete = false;
         m_bParked = false;
         // so give it another try
@@ -1428,7 +1615,6 @@ int CLunaticoBeaver::isCalibratingDomeComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
     int nTmp;
 
     if(!m_bIsConnected)
@@ -1442,47 +1628,34 @@ int CLunaticoBeaver::isCalibratingDomeComplete(bool &bComplete)
         return ERR_CMDFAILED;
     }
 
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nTmp = std::stoi(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingDomeComplete] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-        switch(nTmp) {
-            case 0:
-                bComplete = true;
-                break;
-            case 1:
-                bComplete = false;
-                break;
-            case 2:
-                bComplete = true;
-                break;
-            default:
-                bComplete = false;
-                nErr = ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, nTmp);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isCalibratingDomeComplete] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
+    }
+    switch(nTmp) {
+        case 0:
+            bComplete = true;
+            break;
+        case 1:
+            bComplete = false;
+            break;
+        case 2:
+            bComplete = true;
+            break;
+        default:
+            bComplete = false;
+            nErr = ERR_CMDFAILED;
     }
 
     if(bComplete) {
         m_bCalibrating = false;
         nErr = getDomeStepPerDeg(m_dStepsPerDeg);
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingDomeComplete] final m_dStepsPerDeg  : "  << std::fixed << std::setprecision(2) << m_dStepsPerDeg << std::endl;
-        m_sLogFile.flush();
-#endif
+        updateMotionProfile();
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isCalibratingDomeComplete] final m_dStepsPerDeg  : "  << std::fixed << std::setprecision(2) << m_dStepsPerDeg << std::endl;
     }
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingDomeComplete] final m_bCalibrating  : " << (m_bCalibrating?"True":"False") << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingDomeComplete] final bComplete       : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isCalibratingDomeComplete] final m_bCalibrating  : " << (m_bCalibrating?"True":"False") << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isCalibratingDomeComplete] final bComplete       : " << (bComplete?"True":"False") << std::endl;
     return nErr;
 }
 
@@ -1490,7 +1663,6 @@ int CLunaticoBeaver::isCalibratingShutterComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
     int nTmp;
 
     if(!m_bIsConnected)
@@ -1504,42 +1676,31 @@ int CLunaticoBeaver::isCalibratingShutterComplete(bool &bComplete)
         return ERR_CMDFAILED;
     }
 
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nTmp = std::stoi(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingShutterComplete] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-        switch(nTmp) {
-            case 0:
-                bComplete = true;
-                break;
-            case 1:
-                bComplete = false;
-                break;
-            case 2:
-                bComplete = true;
-                break;
-            default:
-                bComplete = false;
-                nErr = ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, nTmp);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isCalibratingShutterComplete] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
+    }
+    switch(nTmp) {
+        case 0:
+            bComplete = true;
+            break;
+        case 1:
+            bComplete = false;
+            break;
+        case 2:
+            bComplete = true;
+            break;
+        default:
+            bComplete = false;
+            nErr = ERR_CMDFAILED;
     }
 
     if(bComplete)
         m_bCalibrating = false;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingShutterComplete] final m_bCalibrating  : " << (m_bCalibrating?"True":"False") << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isCalibratingShutterComplete] final bComplete       : " << (bComplete?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isCalibratingShutterComplete] final m_bCalibrating  : " << (m_bCalibrating?"True":"False") << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isCalibratingShutterComplete] final bComplete       : " << (bComplete?"True":"False") << std::endl;
     return nErr;
 }
 
@@ -1559,10 +1720,43 @@ int CLunaticoBeaver::abortCurrentCommand()
     m_nGotoTries = 1;   // prevents the goto retry
     m_nHomingTries = 1; // prevents the find home retry
 
-    nErr = domeCommand("!dome abort 1 1 1#", sResp);
+    // unless dapiAbort already sent it and nothing moved the dome since
+    if(m_nAbortedMotionCount != m_nMotionCmdCount)
+        nErr = sendAbort();
+    // where the dome was when told to stop, rather than another round trip
+    if(!getPredictedAz(m_dGotoAz))
+        getDomeAz(m_dGotoAz);
+    {
+        std::lock_guard<std::mutex> lock(m_MotionMutex);
+        m_MotionModel.Stop();
+    }
+    for(int i = 0; i < MOVE_TYPES; i++)
+        stopMoveETA(i);
+    m_bGotoVia = false;
+    m_bGotoAbsorbed = false;
+    m_bGotoCancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(m_DeadbandMutex);
+        m_TrackingDeadband.Reset();
+    }
+
+    return nErr;
+}
+
+int CLunaticoBeaver::sendAbort()
+{
+    int nErr;
+    std::string sResp;
 
-    getDomeAz(m_dGotoAz);
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
 
+    m_nAbortRequestTime = steadyNow();
+    nErr = domeCommand("!dome abort 1 1 1#", sResp);
+    markStateChanged();
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [sendAbort] ERROR : " << nErr << " , sResp : " << sResp << std::endl;
+    }
     return nErr;
 }
 
@@ -1570,8 +1764,8 @@ int CLunaticoBeaver::abortCurrentCommand()
 int CLunaticoBeaver::getShutterPresent(bool &bShutterPresent)
 {
     int nErr = PLUGIN_OK;
+    int nTmp;
     std::string sResp;
-    std::vector<std::string> svFields;
 
     bShutterPresent = false;
 
@@ -1587,26 +1781,16 @@ int CLunaticoBeaver::getShutterPresent(bool &bShutterPresent)
     }
 
     // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            bShutterPresent = (std::stoi(svFields[1])==1);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterPresent] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-        m_bShutterPresent = bShutterPresent;
+    nErr = parseValue(sResp, nTmp);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterPresent] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
     }
+    bShutterPresent = (nTmp == 1);
+    m_bShutterPresent = bShutterPresent;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterPresent] sResp             : " << sResp << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterPresent] m_bShutterPresent : " << (m_bShutterPresent?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getShutterPresent] sResp             : " << sResp << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getShutterPresent] m_bShutterPresent : " << (m_bShutterPresent?"True":"False") << std::endl;
 
 
     bShutterPresent = m_bShutterPresent;
@@ -1642,11 +1826,95 @@ int CLunaticoBeaver::saveSettingsToEEProm()
     return nErr;
 }
 
+int CLunaticoBeaver::applySettings(const DomeSettings &Current, const DomeSettings &New)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> svCmds;
+    std::vector<std::string> svResps;
+    std::stringstream ssTmp;
+    bool bCutOffChanged = false;
+    bool bStepsChanged = false;
+    bool bRotationChanged;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    // home and park are sent with 2 decimals, anything smaller is not a change
+    if(fabs(New.dHomeAz - Current.dHomeAz) >= 0.005) {
+        ssTmp << "!domerot sethome " << std::fixed << std::setprecision(2) << New.dHomeAz << "#";
+        svCmds.push_back(ssTmp.str());
+        std::stringstream().swap(ssTmp);
+    }
+    if(fabs(New.dParkAz - Current.dParkAz) >= 0.005) {
+        ssTmp << "!domerot setpark " << std::fixed << std::setprecision(2) << New.dParkAz << "#";
+        svCmds.push_back(ssTmp.str());
+        std::stringstream().swap(ssTmp);
+    }
+    if(New.nStepsPerRev != Current.nStepsPerRev && !m_bCalibrating) {
+        ssTmp << "!domerot setstepsperdegree " << std::fixed << std::setprecision(6) << float(New.nStepsPerRev)/360.0 << "#";
+        svCmds.push_back(ssTmp.str());
+        std::stringstream().swap(ssTmp);
+        bStepsChanged = true;
+    }
+    bRotationChanged = bStepsChanged || New.nRotMinSpeed != Current.nRotMinSpeed || New.nRotMaxSpeed != Current.nRotMaxSpeed || New.nRotAccel != Current.nRotAccel;
+    if(New.nRotMinSpeed != Current.nRotMinSpeed)
+        svCmds.push_back("!domerot setminspeed " + std::to_string(New.nRotMinSpeed) + "#");
+    if(New.nRotMaxSpeed != Current.nRotMaxSpeed)
+        svCmds.push_back("!domerot setmaxspeed " + std::to_string(New.nRotMaxSpeed) + "#");
+    if(New.nRotAccel != Current.nRotAccel)
+        svCmds.push_back("!domerot setacceleration " + std::to_string(New.nRotAccel) + "#");
+
+    if(New.bShutter) {
+        if(New.nShutMinSpeed != Current.nShutMinSpeed)
+            svCmds.push_back("!dome setshutterminspeed " + std::to_string(New.nShutMinSpeed) + "#");
+        if(New.nShutMaxSpeed != Current.nShutMaxSpeed)
+            svCmds.push_back("!dome setshuttermaxspeed " + std::to_string(New.nShutMaxSpeed) + "#");
+        if(New.nShutAccel != Current.nShutAccel)
+            svCmds.push_back("!dome setshutteracceleration " + std::to_string(New.nShutAccel) + "#");
+        if(fabs(New.dShutterCutOff - Current.dShutterCutOff) >= 0.005) {
+            ssTmp << "!dome sendtoshutter \"shutter setsafevoltage " << New.dShutterCutOff << "\"#";
+            svCmds.push_back(ssTmp.str());
+            std::stringstream().swap(ssTmp);
+            bCutOffChanged = true;
+        }
+    }
+
+    if(svCmds.empty()) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_UI) << " [applySettings] nothing changed." << std::endl;
+        return nErr;
+    }
+
+    svCmds.push_back("!seletek savefs#");
+    nErr = domeCommandBatch(svCmds, svResps);
+    // as in setBatteryCutOff, read back what the shutter kept even if the batch failed part way
+    if(bCutOffChanged)
+        m_BatteryCache.InvalidateCutOff();
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_UI) << " [applySettings] ERROR : " << nErr << std::endl;
+        return nErr;
+    }
+
+    m_dHomeAz = New.dHomeAz;
+    m_dParkAz = New.dParkAz;
+    if(!m_bCalibrating)
+        m_nNbStepPerRev = New.nStepsPerRev;
+    if(bStepsChanged)
+        m_dStepsPerDeg = float(New.nStepsPerRev)/360.0;
+    // the move ETA, the slew planner and the tolerance speed bins work from the motion profile
+    if(bRotationChanged)
+        updateMotionProfile();
+
+    PLUGIN_LOG(LOG_DEBUG, LOG_UI) << " [applySettings] " << svCmds.size()-1 << " setting(s) written and saved." << std::endl;
+
+    return nErr;
+}
+
 int CLunaticoBeaver::isShutterDetected(bool &bDetected)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> firmwareFields;
+    const char *pszField;
+    size_t nFieldLen;
 
     bDetected = false;
 
@@ -1659,28 +1927,19 @@ int CLunaticoBeaver::isShutterDetected(bool &bDetected)
     nErr = shutterCommand("!seletek version#", sResp);
     if(nErr)
         return nErr;
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] szFirmware : " << sResp << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isShutterDetected] szFirmware : " << sResp << std::endl;
 
-    nErr = parseFields(sResp, firmwareFields, ':');
+    nErr = getResponseField(sResp, pszField, nFieldLen);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] parsing error : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [isShutterDetected] parsing error : " << nErr << std::endl;
         return ERR_CMDFAILED;
     }
 
-    if(firmwareFields.size()>=2) {
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] sResp.size()          : " << sResp.size() << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] sResp                 : " << sResp << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] sResp.find(\"error\") : " << sResp.find("error") << std::endl;
-        m_sLogFile.flush();
-#endif
-        if(firmwareFields[1].size()>5 && firmwareFields[1].find("error") == 0) {
+    if(nFieldLen) {
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isShutterDetected] sResp.size()          : " << sResp.size() << std::endl;
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isShutterDetected] sResp                 : " << sResp << std::endl;
+        PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isShutterDetected] sResp.find(\"error\") : " << sResp.find("error") << std::endl;
+        if(nFieldLen>5 && strncmp(pszField, "error", 5) == 0) {
             bDetected = false;
         }
         else {
@@ -1689,10 +1948,7 @@ int CLunaticoBeaver::isShutterDetected(bool &bDetected)
     }
 
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isShutterDetected] bDetected : " << (bDetected?"True":"False") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [isShutterDetected] bDetected : " << (bDetected?"True":"False") << std::endl;
 
     return nErr;
 
@@ -1701,19 +1957,13 @@ int CLunaticoBeaver::isShutterDetected(bool &bDetected)
 
 int CLunaticoBeaver::getDomeStepPerRev()
 {
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getNbTicksPerRev] m_bIsConnected : " << (m_bIsConnected?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getNbTicksPerRev] m_bIsConnected : " << (m_bIsConnected?"Yes":"No") << std::endl;
 
     if(m_bIsConnected) {
         getDomeStepPerDeg(m_dStepsPerDeg);
         m_nNbStepPerRev = int(m_dStepsPerDeg*360.0);
     }
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getNbTicksPerRev] m_nNbStepPerRev : " << m_nNbStepPerRev << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getNbTicksPerRev] m_nNbStepPerRev : " << m_nNbStepPerRev << std::endl;
 
     return m_nNbStepPerRev;
 }
@@ -1743,7 +1993,6 @@ int CLunaticoBeaver::getDomeStepPerDeg(double &dStepsPerDeg)
 {
     int nErr = PLUGIN_OK;
     std::string sResp;
-    std::vector<std::string> svFields;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -1752,25 +2001,14 @@ int CLunaticoBeaver::getDomeStepPerDeg(double &dStepsPerDeg)
     dStepsPerDeg = 0;
     nErr = domeCommand("!domerot getstepsperdegree#", sResp);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStepPerDeg] ERROR : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStepPerDeg] ERROR : " << nErr << std::endl;
         return nErr;
     }
 
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            dStepsPerDeg = std::stof(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getDomeStepPerDeg] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    nErr = parseValue(sResp, dStepsPerDeg);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getDomeStepPerDeg] conversion error : " << sResp << std::endl;
+        return ERR_CMDFAILED;
     }
 
     m_dStepsPerDeg = dStepsPerDeg;
@@ -1799,8 +2037,10 @@ int CLunaticoBeaver::setDomeStepPerDeg(double dStepsPerDeg)
 
 double CLunaticoBeaver::getHomeAz()
 {
+    double dAz;
+
     if(m_bIsConnected)
-        getDomeHomeAz(m_dHomeAz);
+        getDomeHomeAz(dAz);     // updates m_dHomeAz
     return m_dHomeAz;
 }
 
@@ -1823,8 +2063,10 @@ int CLunaticoBeaver::setHomeAz(double dAz)
 
 double CLunaticoBeaver::getParkAz()
 {
+    double dAz;
+
     if(m_bIsConnected)
-        getDomeParkAz(m_dParkAz);
+        getDomeParkAz(dAz);     // updates m_dParkAz
 
     return m_dParkAz;
 
@@ -1847,12 +2089,13 @@ int CLunaticoBeaver::setParkAz(double dAz)
 }
 
 
+// Between poller samples the position comes from the motion model, so TheSkyX sees a smooth
+// slew without a serial round trip per call.
 double CLunaticoBeaver::getCurrentAz()
 {
 
-    if(m_bIsConnected) {
+    if(m_bIsConnected && !getPredictedAz(m_dCurrentAzPosition))
         getDomeAz(m_dCurrentAzPosition);
-   }
     return m_dCurrentAzPosition;
 }
 
@@ -1864,6 +2107,18 @@ double CLunaticoBeaver::getCurrentEl()
     return m_dCurrentElPosition;
 }
 
+// No serial I/O and no lock other than the motion model's, so TheSkyX's position
+// reads don't wait behind a slow shutter command. Nothing is written either.
+bool CLunaticoBeaver::getCachedAzEl(double &dAz, double &dEl)
+{
+    if(!m_bIsConnected)
+        return false;
+    if(!getPredictedAz(dAz))
+        return false;
+    dEl = m_bShutterOpened ? 90.0 : 0.0;
+    return true;
+}
+
 int CLunaticoBeaver::getCurrentShutterState()
 {
     if(m_bIsConnected)
@@ -1886,371 +2141,1271 @@ int CLunaticoBeaver::getRainSensorStatus(int &nStatus)
 
     nStatus = m_nRainSensorstate;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRainSensorStatus] nStatus : " << (m_nRainSensorstate==RAINING?"Raining":"Not Raining") << std::endl;
-    m_sLogFile.flush();
-#endif
+    PLUGIN_LOG(LOG_INFO, LOG_RAIN) << " [getRainSensorStatus] nStatus : " << (m_nRainSensorstate==RAINING?"Raining":"Not Raining") << std::endl;
 
     return nErr;
 }
 
-int CLunaticoBeaver::getRotationSpeed(int &nMinSpeed, int &nMaxSpeed, int &nAccel)
+#pragma mark - telemetry
+
+void CLunaticoBeaver::enableTelemetry(bool bEnable)
 {
-    int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> svFields;
+    m_bTelemetry = bEnable;
+    if(!bEnable)
+        m_Telemetry.Close();
+    else if(m_bIsConnected)
+        m_Telemetry.Open();
+}
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+// after each status sample, from the poller or from getDomeStatus when the poller is off
+void CLunaticoBeaver::updateTelemetryStatus(int nStatus, double dAz)
+{
+    DomeStatus Status;
+    double dTargetAz = 0;
+    bool bHasTarget;
+    BeaverTelemetry *pTelemetry;
 
-    nErr = domeCommand("!domerot getminspeed#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] getminspeed ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
-        return nErr;
-    }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nMinSpeed = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    decodeDomeStatus(nStatus, Status);
+    {
+        std::lock_guard<std::mutex> lock(m_MotionMutex);
+        bHasTarget = m_MotionModel.GetTarget(dTargetAz);
     }
 
-    nErr = domeCommand("!domerot getmaxspeed#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] getmaxspeed ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
+    pTelemetry = m_Telemetry.BeginUpdate();
+    if(!pTelemetry)
+        return;
+    pTelemetry->bConnected = m_bIsConnected;
+    pTelemetry->nStatus = nStatus;
+    pTelemetry->nShutterState = Status.nShutterState;
+    pTelemetry->nRain = Status.bRaining ? RAINING : NOT_RAINING;
+    pTelemetry->dAz = dAz;
+    pTelemetry->dTargetAz = dTargetAz;
+    pTelemetry->bHasTarget = bHasTarget;
+    pTelemetry->nStatusTime = epochMicroseconds();
+    m_Telemetry.EndUpdate(pTelemetry->nStatusTime);
+}
 
-#endif
-        return nErr;
+// getDomeAz when the poller is off, the status fields keep the last status read
+void CLunaticoBeaver::updateTelemetryAz(double dAz)
+{
+    double dTargetAz = 0;
+    bool bHasTarget;
+    BeaverTelemetry *pTelemetry;
+
+    {
+        std::lock_guard<std::mutex> lock(m_MotionMutex);
+        bHasTarget = m_MotionModel.GetTarget(dTargetAz);
     }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nMaxSpeed = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+
+    pTelemetry = m_Telemetry.BeginUpdate();
+    if(!pTelemetry)
+        return;
+    pTelemetry->bConnected = m_bIsConnected;
+    pTelemetry->dAz = dAz;
+    pTelemetry->dTargetAz = dTargetAz;
+    pTelemetry->bHasTarget = bHasTarget;
+    m_Telemetry.EndUpdate(epochMicroseconds());
+}
+
+void CLunaticoBeaver::updateTelemetryBattery(double dShutterVolts, double dShutterCutOff)
+{
+    BeaverTelemetry *pTelemetry;
+
+    pTelemetry = m_Telemetry.BeginUpdate();
+    if(!pTelemetry)
+        return;
+    pTelemetry->dShutterVolts = dShutterVolts;
+    pTelemetry->dShutterCutOff = dShutterCutOff;
+    pTelemetry->nBatteryTime = epochMicroseconds();
+    m_Telemetry.EndUpdate(pTelemetry->nBatteryTime);
+}
+
+// the statistics are copied out of their lock before the segment is locked
+void CLunaticoBeaver::updateTelemetryStats()
+{
+    std::vector<CommandLatency> Stats;
+    CommandLatency AbortLatency;
+    unsigned long nDroppedPolls;
+    BeaverTelemetry *pTelemetry;
+    size_t nVerbs;
+
+    if(!m_Telemetry.IsOpen())
+        return;
+    getCommandStats(Stats);
+    getAbortStats(AbortLatency, nDroppedPolls);
+    nVerbs = std::min(Stats.size(), size_t(TELEMETRY_MAX_VERBS));
+
+    pTelemetry = m_Telemetry.BeginUpdate();
+    if(!pTelemetry)
+        return;
+    for(size_t i = 0; i < nVerbs; i++) {
+        TelemetryLatency &Latency = pTelemetry->Latency[i];
+        snprintf(Latency.szVerb, TELEMETRY_VERB_SIZE, "%s%s", Stats[i].bShutter ? "(shutter) " : "", Stats[i].sVerb.c_str());
+        Latency.nCount = uint32_t(Stats[i].nCount);
+        Latency.nTimeouts = uint32_t(Stats[i].nTimeouts);
+        Latency.nErrors = uint32_t(Stats[i].nErrors);
+        Latency.nP50Us = uint32_t(Stats[i].nP50Us);
+        Latency.nP99Us = uint32_t(Stats[i].nP99Us);
+        Latency.nMaxUs = uint32_t(Stats[i].nMaxUs);
     }
+    pTelemetry->nVerbs = uint32_t(nVerbs);
+    pTelemetry->nAbortP99Us = uint32_t(AbortLatency.nP99Us);
+    m_Telemetry.EndUpdate(epochMicroseconds());
+}
 
-    nErr = domeCommand("!domerot getacceleration#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] getacceleration ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
-        return nErr;
+int64_t CLunaticoBeaver::epochMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#pragma mark - rain reaction
+
+void CLunaticoBeaver::setRainReaction(int nAction, bool bCloseShutter, int nSampleInterval, int nDebounce)
+{
+    m_nRainAction = (nAction == HOME || nAction == PARK) ? nAction : DO_NOTHING;
+    m_bRainCloseShutter = bCloseShutter;
+    m_nRainSampleInterval = nSampleInterval > 0 ? nSampleInterval : RAIN_SAMPLE_INTERVAL;
+    m_nRainDebounce = nDebounce > 0 ? nDebounce : 0;
+    PLUGIN_LOG(LOG_INFO, LOG_UI) << " [setRainReaction] action : " << m_nRainAction << " , close shutter : " << (bCloseShutter?"Yes":"No") << " , sample interval : " << m_nRainSampleInterval << " ms , debounce : " << m_nRainDebounce << " ms" << std::endl;
+    // the reaction needs the poller, even with the status poll turned off
+    if(m_bIsConnected)
+        startStatusPoller();
+    m_PollerWakeup.notify_all();
+}
+
+bool CLunaticoBeaver::isRainReactionSet()
+{
+    return m_nRainAction != DO_NOTHING || m_bRainCloseShutter;
+}
+
+// status poller thread, after each sample
+void CLunaticoBeaver::checkRain(int nStatus, long long nSampleTime)
+{
+    int nEvent;
+
+    if(m_bSaveRainStatus)
+        m_RainStatusFile.Publish((nStatus & RAIN_SENSOR_MASK) != 0);
+
+    m_RainWatcher.SetDebounce(m_nRainDebounce);
+    nEvent = m_RainWatcher.AddSample((nStatus & RAIN_SENSOR_MASK) != 0, nSampleTime);
+
+    if(nEvent == RAIN_EVENT_STARTED) {
+        logRainEvent("rain detected", m_RainWatcher.GetOnset());
+        if(isRainReactionSet())
+            runRainActions(nStatus);
     }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nAccel = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
+    else if(nEvent == RAIN_EVENT_STOPPED) {
+        logRainEvent("rain stopped", m_RainWatcher.GetOnset());
+        m_bRainMovePending = false;
+    }
+    else if(m_RainWatcher.IsRaining() && isRainReactionSet()) {
+        retryRainActions(nStatus);
     }
 
+    if(m_nRainCloseSent && (nStatus & SHUTTER_CLOSED)) {
+        logRainEvent("shutter closed", m_RainWatcher.GetOnset());
+        m_nRainCloseSent = 0;
+    }
+}
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] nMinSpeed : " << nMinSpeed << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] nMaxSpeed : " << nMaxSpeed << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getRotationSpeed] nAccel    : " << nAccel << std::endl;
-    m_sLogFile.flush();
-#endif
+// Straight from the poller, ahead of anything else waiting for the port.
+void CLunaticoBeaver::runRainActions(int nStatus)
+{
+    if(m_bRainCloseShutter && !(nStatus & SHUTTER_CLOSED))
+        rainCloseShutter(false);
 
-    return nErr;
+    m_bRainMovePending = (m_nRainAction != DO_NOTHING);
+    if(m_bRainMovePending)
+        rainMove(false);
 }
 
-int CLunaticoBeaver::setRotationSpeed(int nMinSpeed, int nMaxSpeed, int nAccel)
+// Still raining : a close that didn't go through or a shutter opened again is closed,
+// and a park or home that failed is sent again, no more than once per RAIN_RETRY_INTERVAL.
+void CLunaticoBeaver::retryRainActions(int nStatus)
 {
-    int nErr = PLUGIN_OK;
+    long long nNow = steadyNow();
+    long long nInterval = RAIN_RETRY_INTERVAL * 1000000LL;
+
+    if(m_bRainCloseShutter && !(nStatus & (SHUTTER_CLOSED | SHUTTER_CLOSING)) && nNow - m_nRainCloseTried >= nInterval)
+        rainCloseShutter(true);
+
+    if(m_bRainMovePending && nNow - m_nRainMoveTried >= nInterval)
+        rainMove(true);
+}
+
+void CLunaticoBeaver::rainCloseShutter(bool bRetry)
+{
+    int nErr;
     std::string sResp;
-    std::stringstream ssTmp;
+
+    m_nRainCloseTried = steadyNow();
+    nErr = domeCommand("!dome closeshutter#", sResp, MAX_TIMEOUT, PRIORITY_ABORT);
+    markStateChanged();
+    if(nErr) {
+        PLUGIN_LOG(LOG_INFO, LOG_RAIN) << " [rainCloseShutter] closeshutter ERROR : " << nErr << " , sResp : " << sResp << std::endl;
+        logRainEvent("closing the shutter failed, will retry", m_RainWatcher.GetOnset());
+        return;
+    }
+    m_nRainCloseSent = steadyNow();
+    logRainEvent(bRetry ? "closing the shutter again" : "closing the shutter", m_RainWatcher.GetOnset());
+}
+
+// The park and home state is set like parkDome and goHome do, and a goto in progress
+// is dropped so isGoToComplete doesn't retry it or go on to its via point.
+void CLunaticoBeaver::rainMove(bool bRetry)
+{
+    int nErr;
+    std::string sResp;
+    double dAz;
+
+    m_nRainMoveTried = steadyNow();
+    switch(m_nRainAction) {
+        case HOME :
+            nErr = domeCommand("!dome gohome 300#", sResp, MAX_TIMEOUT, PRIORITY_ABORT);
+            markStateChanged();
+            if(!nErr) {
+                m_bGotoCancelled = true;
+                stopMoveETA(MOVE_GOTO);
+                m_bParked = false;
+                m_bParking = false;
+                m_bUnParking = false;
+                m_nHomingTries = 0;
+                dAz = m_dHomeAz;
+                setMotionTarget(dAz);
+                logRainEvent(bRetry ? "going home again" : "going home", m_RainWatcher.GetOnset());
+            }
+            break;
+        case PARK :
+            nErr = domeCommand("!dome gopark#", sResp, MAX_TIMEOUT, PRIORITY_ABORT);
+            markStateChanged();
+            if(!nErr) {
+                m_bGotoCancelled = true;
+                stopMoveETA(MOVE_GOTO);
+                m_bParked = false;
+                m_bParking = false;    // already going straight to park, no home first
+                m_bUnParking = false;
+                dAz = m_dParkAz;
+                setMotionTarget(dAz);
+                startMoveETA(MOVE_PARK, getMotionTime());
+                logRainEvent(bRetry ? "parking again" : "parking", m_RainWatcher.GetOnset());
+            }
+            break;
+        default :
+            // the reaction was changed since
+            m_bRainMovePending = false;
+            return;
+    }
+    if(nErr) {
+        PLUGIN_LOG(LOG_INFO, LOG_RAIN) << " [rainMove] rain action " << m_nRainAction << " ERROR : " << nErr << " , sResp : " << sResp << std::endl;
+        logRainEvent(m_nRainAction == HOME ? "going home failed, will retry" : "parking failed, will retry", m_RainWatcher.GetOnset());
+        return;
+    }
+    m_bRainMovePending = false;
+}
+
+// nOnset is the first sample of the rain change, so the delay includes the debounce
+void CLunaticoBeaver::logRainEvent(const char *pszEvent, long long nOnset)
+{
+    char szLine[LOG_LINE_SIZE];
+    long long nDelayMs = (steadyNow() - nOnset) / 1000000LL;
+
+    PLUGIN_LOG(LOG_INFO, LOG_RAIN) << " [rain] " << pszEvent << " , " << nDelayMs << " ms after the first sample" << std::endl;
+    if(m_pLogger) {
+        snprintf(szLine, LOG_LINE_SIZE, "[LunaticoBeaver] %s , %lld ms after the first sample", pszEvent, nDelayMs);
+        m_pLogger->out(szLine);
+    }
+}
+
+int CLunaticoBeaver::getRotationSpeed(int &nMinSpeed, int &nMaxSpeed, int &nAccel)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<double> dvValues;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    ssTmp<<"!domerot setminspeed " << nMinSpeed << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr)
-        return nErr;
-    std::stringstream().swap(ssTmp);
-    ssTmp<<"!domerot setmaxspeed " << nMaxSpeed << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr)
+    nErr = getValues({"!domerot getminspeed#", "!domerot getmaxspeed#", "!domerot getacceleration#"}, dvValues);
+    if(nErr) {
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getRotationSpeed] ERROR : " << nErr << std::endl;
         return nErr;
+    }
+    nMinSpeed = int(dvValues[0]);
+    nMaxSpeed = int(dvValues[1]);
+    nAccel = int(dvValues[2]);
 
-    std::stringstream().swap(ssTmp);
-    ssTmp<<"!domerot setacceleration " << nAccel << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr)
-        return nErr;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getRotationSpeed] nMinSpeed : " << nMinSpeed << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getRotationSpeed] nMaxSpeed : " << nMaxSpeed << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getRotationSpeed] nAccel    : " << nAccel << std::endl;
 
     return nErr;
 }
 
+int CLunaticoBeaver::setRotationSpeed(int nMinSpeed, int nMaxSpeed, int nAccel)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> svCmds;
+    std::vector<std::string> svResps;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    svCmds.push_back("!domerot setminspeed " + std::to_string(nMinSpeed) + "#");
+    svCmds.push_back("!domerot setmaxspeed " + std::to_string(nMaxSpeed) + "#");
+    svCmds.push_back("!domerot setacceleration " + std::to_string(nAccel) + "#");
+    nErr = domeCommandBatch(svCmds, svResps);
+    if(!nErr)
+        updateMotionProfile();
+    return nErr;
+}
+
 
 int CLunaticoBeaver::getShutterSpeed(int &nMinSpeed, int &nMaxSpeed, int &nAccel)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> svFields;
+    std::vector<double> dvValues;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = domeCommand("!dome getshutterminspeed#", sResp);
+    nErr = getValues({"!dome getshutterminspeed#", "!dome getshuttermaxspeed#", "!dome getshutteracceleration#"}, dvValues);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] getshutterminspeed ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getShutterSpeed] ERROR : " << nErr << std::endl;
         return nErr;
     }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nMinSpeed = std::stod(svFields[1]);
-        }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
-        }
-    }
+    nMinSpeed = int(dvValues[0]);
+    nMaxSpeed = int(dvValues[1]);
+    nAccel = int(dvValues[2]);
+
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getShutterSpeed] nMinSpeed : " << nMinSpeed << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getShutterSpeed] nMaxSpeed : " << nMaxSpeed << std::endl;
+    PLUGIN_LOG(LOG_INFO, LOG_STATE) << " [getShutterSpeed] nAccel    : " << nAccel << std::endl;
+
+    return nErr;
+}
 
-    nErr = domeCommand("!dome getshuttermaxspeed#", sResp);
+int CLunaticoBeaver::getSpeeds(int &nRotMinSpeed, int &nRotMaxSpeed, int &nRotAccel, int &nShutMinSpeed, int &nShutMaxSpeed, int &nShutAccel)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<double> dvValues;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    nErr = getValues({"!domerot getminspeed#", "!domerot getmaxspeed#", "!domerot getacceleration#",
+                      "!dome getshutterminspeed#", "!dome getshuttermaxspeed#", "!dome getshutteracceleration#"}, dvValues);
     if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] getshuttermaxspeed ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
+        PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [getSpeeds] ERROR : " << nErr << std::endl;
         return nErr;
     }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nMaxSpeed = std::stod(svFields[1]);
+    nRotMinSpeed = int(dvValues[0]);
+    nRotMaxSpeed = int(dvValues[1]);
+    nRotAccel = int(dvValues[2]);
+    nShutMinSpeed = int(dvValues[3]);
+    nShutMaxSpeed = int(dvValues[4]);
+    nShutAccel = int(dvValues[5]);
+
+    return nErr;
+}
+
+
+int CLunaticoBeaver::setShutterSpeed(int nMinSpeed, int nMaxSpeed, int nAccel)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> svCmds;
+    std::vector<std::string> svResps;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    svCmds.push_back("!dome setshutterminspeed " + std::to_string(nMinSpeed) + "#");
+    svCmds.push_back("!dome setshuttermaxspeed " + std::to_string(nMaxSpeed) + "#");
+    svCmds.push_back("!dome setshutteracceleration " + std::to_string(nAccel) + "#");
+    nErr = domeCommandBatch(svCmds, svResps);
+    return nErr;
+}
+
+
+void CLunaticoBeaver::enableRainStatusFile(bool bEnable)
+{
+    if(bEnable && !m_bSaveRainStatus)
+        m_RainStatusFile.Invalidate();  // rewrite it with the next sample
+    m_bSaveRainStatus = bEnable;
+    // the file is written from the poller samples, even with the status poll turned off
+    if(m_bIsConnected)
+        startStatusPoller();
+    m_PollerWakeup.notify_all();
+}
+void CLunaticoBeaver::getRainStatusFileName(std::string &fName)
+{
+    fName.assign(m_sRainStatusfilePath);
+}
+
+
+#pragma mark - status poller
+
+void CLunaticoBeaver::setStatusPollInterval(int nIntervalMs)
+{
+    if(nIntervalMs > 0 && nIntervalMs < STATUS_POLL_MIN_INTERVAL)
+        nIntervalMs = STATUS_POLL_MIN_INTERVAL;
+    m_nPollInterval = nIntervalMs;
+    m_PollerWakeup.notify_all();
+}
+
+int CLunaticoBeaver::getStatusPollInterval()
+{
+    return m_nPollInterval;
+}
+
+void CLunaticoBeaver::startStatusPoller()
+{
+    if(m_bPollerRunning || getPollInterval() <= 0)
+        return;
+    m_nSnapshotTime = 0;
+    m_RainWatcher.Reset();
+    m_nRainCloseSent = 0;
+    m_nRainCloseTried = 0;
+    m_bRainMovePending = false;
+    m_nRainMoveTried = 0;
+    m_bPollerRunning = true;
+    m_StatusPollerThread = std::thread(&CLunaticoBeaver::statusPoller, this);
+}
+
+void CLunaticoBeaver::stopStatusPoller()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PollerMutex);
+        m_bPollerRunning = false;
+    }
+    m_PollerWakeup.notify_all();
+    if(m_StatusPollerThread.joinable())
+        m_StatusPollerThread.join();
+    m_nSnapshotTime = 0;
+}
+
+void CLunaticoBeaver::statusPoller()
+{
+    int nErr;
+    long long nSampleTime;
+    int nStatus;
+    double dAz;
+    // built once, the poll loop itself doesn't allocate once the buffers have grown.
+    const std::vector<std::string> svCmds = {"!dome status#", "!dome getaz#"};
+    std::vector<std::string> svResps(svCmds.size());
+
+    while(m_bPollerRunning) {
+        nSampleTime = steadyNow();
+        nErr = domeCommandBatch(svCmds, svResps, MAX_TIMEOUT, false, true);
+        if(!nErr && !parseValue(svResps[0], nStatus) && !parseValue(svResps[1], dAz)) {
+            publishStatus(nStatus, dAz, nSampleTime);
+            checkRain(nStatus, nSampleTime);
+            updateTelemetryStatus(nStatus, dAz);
+            checkBatteryRefresh(nStatus);
         }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
+        if(m_cTelemetryStatsTimer.GetElapsedMilliseconds() > TELEMETRY_STATS_INTERVAL) {
+            updateTelemetryStats();
+            m_cTelemetryStatsTimer.Reset();
         }
-    }
 
-    nErr = domeCommand("!dome getshutteracceleration#", sResp);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] getshutteracceleration ERROR : " << nErr << " , sResp : " << sResp << std::endl;
-        m_sLogFile.flush();
-#endif
-        return nErr;
-    }
-    // convert Az string to double
-    parseFields(sResp, svFields, ':');
-    if(svFields.size()>=2) {
-        try {
-            nAccel = std::stod(svFields[1]);
+        if(m_cStatsLogTimer.GetElapsedSeconds() > STATS_LOG_INTERVAL) {
+            logCommandStats();
+            m_cStatsLogTimer.Reset();
         }
-        catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] conversion exception : " << e.what() << std::endl;
-            m_sLogFile.flush();
-#endif
-            return ERR_CMDFAILED;
+
+        std::unique_lock<std::mutex> lock(m_PollerMutex);
+        m_PollerWakeup.wait_for(lock, std::chrono::milliseconds(getPollDelay()), [this]{ return !m_bPollerRunning; });
+    }
+}
+
+// ms between samples when nothing is moving, 0 if the poller isn't needed. The rain
+// reaction keeps it on at the rain sample interval, the rain status file at RAIN_FILE_INTERVAL.
+int CLunaticoBeaver::getPollInterval()
+{
+    int nInterval = m_nPollInterval;
+    int nRainInterval = 0;
+
+    if(isRainReactionSet())
+        nRainInterval = std::max(int(m_nRainSampleInterval), STATUS_POLL_MIN_INTERVAL);
+    else if(m_bSaveRainStatus)
+        nRainInterval = RAIN_FILE_INTERVAL;
+
+    if(nInterval <= 0)
+        return nRainInterval;
+    return nRainInterval ? std::min(nInterval, nRainInterval) : nInterval;
+}
+
+// While a move is in progress the poll follows its ETA : sparse early in a long move,
+// dense around the expected arrival so completion is seen as soon as it happens.
+int CLunaticoBeaver::getPollDelay()
+{
+    int nInterval = getPollInterval();
+    long long nNow = steadyNow();
+
+    if(nInterval <= 0)
+        nInterval = STATUS_POLL_INTERVAL;
+    long long nDelay = -1;
+    long long nMoveDelay;
+    double dRemaining;
+
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    for(int i = 0; i < MOVE_TYPES; i++) {
+        dRemaining = m_MoveETA[i].Remaining(nNow);
+        if(dRemaining < 0)
+            continue;
+        nMoveDelay = (long long)(dRemaining * 500.0);  // half the remaining time, in ms
+        nMoveDelay = std::max(nMoveDelay, (long long)STATUS_POLL_MIN_INTERVAL);
+        nMoveDelay = std::min(nMoveDelay, 2LL * nInterval);
+        if(nDelay < 0 || nMoveDelay < nDelay)
+            nDelay = nMoveDelay;
+    }
+    return nDelay < 0 ? nInterval : int(nDelay);
+}
+
+void CLunaticoBeaver::publishStatus(int nStatus, double dAz, long long nSampleTime)
+{
+    m_nSnapshotSeq.fetch_add(1, std::memory_order_acq_rel);
+    m_nSnapshotStatus.store(nStatus, std::memory_order_relaxed);
+    m_dSnapshotAz.store(dAz, std::memory_order_relaxed);
+    m_nSnapshotTime.store(nSampleTime, std::memory_order_relaxed);
+    m_nSnapshotSeq.fetch_add(1, std::memory_order_release);
+
+    // a sample taken before the last goto/abort/sync would undo what the model was told
+    if(nSampleTime > m_nStateChangeTime) {
+        double dRemaining;
+        {
+            std::lock_guard<std::mutex> lock(m_MotionMutex);
+            m_MotionModel.AddSample(dAz, nSampleTime, (nStatus & DOME_MOVING) != 0);
+            dRemaining = m_MotionModel.TimeToTarget();
         }
+        // the measured speed says more about the arrival than the start of move prediction
+        std::lock_guard<std::mutex> lock(m_ETAMutex);
+        m_MoveETA[MOVE_GOTO].Refine(dRemaining, nSampleTime);
+        m_MoveETA[MOVE_PARK].Refine(dRemaining, nSampleTime);
     }
+}
 
+// Returns false if there is no usable snapshot : poller not running, stale, or
+// sampled before the last command that changed the dome state.
+bool CLunaticoBeaver::getStatusSnapshot(int &nStatus, double &dAz)
+{
+    unsigned int nSeq;
+    long long nSampleTime;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] nMinSpeed : " << nMinSpeed << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] nMaxSpeed : " << nMaxSpeed << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getShutterSpeed] nAccel    : " << nAccel << std::endl;
-    m_sLogFile.flush();
-#endif
+    if(!m_bPollerRunning)
+        return false;
 
-    return nErr;
+    do {
+        nSeq = m_nSnapshotSeq.load(std::memory_order_acquire);
+        nStatus = m_nSnapshotStatus.load(std::memory_order_relaxed);
+        dAz = m_dSnapshotAz.load(std::memory_order_relaxed);
+        nSampleTime = m_nSnapshotTime.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((nSeq & 1) || nSeq != m_nSnapshotSeq.load(std::memory_order_relaxed));
+
+    if(!nSampleTime || nSampleTime <= m_nStateChangeTime)
+        return false;
+    // don't trust a snapshot from a stalled poller
+    if(steadyNow() - nSampleTime > 4LL * std::max(getPollInterval(), STATUS_POLL_MIN_INTERVAL) * 1000000LL)
+        return false;
+    return true;
 }
 
+void CLunaticoBeaver::markStateChanged()
+{
+    m_nStateChangeTime = steadyNow();
+}
 
-int CLunaticoBeaver::setShutterSpeed(int nMinSpeed, int nMaxSpeed, int nAccel)
+long long CLunaticoBeaver::steadyNow()
 {
-    int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::stringstream ssTmp;
+    return (m_pClock ? m_pClock : CClock::GetDefault())->Now();
+}
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+// NULL goes back to the default clock. Call before Connect.
+void CLunaticoBeaver::setClock(CClock *pClock)
+{
+    m_pClock = pClock;
+    m_cStatsLogTimer.SetClock(pClock);
+    m_cTelemetryStatsTimer.SetClock(pClock);
+}
 
-    ssTmp<<"!dome setshutterminspeed " << nMinSpeed << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr)
-        return nErr;
+#pragma mark - motion model
 
-    std::stringstream().swap(ssTmp);
-    ssTmp<<"!dome setshuttermaxspeed " << nMaxSpeed << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
-    if(nErr)
-        return nErr;
+// the controller works in steps, the model in degrees.
+int CLunaticoBeaver::updateMotionProfile()
+{
+    int nErr;
+    int nMinSpeed, nMaxSpeed, nAccel;
+    double dStepsPerDeg;
 
-    std::stringstream().swap(ssTmp);
-    ssTmp<<"!dome setshutteracceleration " << nAccel << "#";
-    nErr = domeCommand(ssTmp.str(), sResp);
+    nErr = getRotationSpeed(nMinSpeed, nMaxSpeed, nAccel);
     if(nErr)
         return nErr;
+    dStepsPerDeg = m_dStepsPerDeg;
+    if(dStepsPerDeg <= 0) {
+        nErr = getDomeStepPerDeg(dStepsPerDeg);
+        if(nErr || dStepsPerDeg <= 0)
+            return nErr ? nErr : ERR_CMDFAILED;
+    }
 
-    return nErr;
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    m_MotionModel.SetProfile(nMinSpeed / dStepsPerDeg, nMaxSpeed / dStepsPerDeg, nAccel / dStepsPerDeg);
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [updateMotionProfile] min speed : " << std::fixed << std::setprecision(2) << nMinSpeed / dStepsPerDeg << " deg/s , max speed : " << nMaxSpeed / dStepsPerDeg << " deg/s , acceleration : " << nAccel / dStepsPerDeg << " deg/s^2" << std::endl;
+    return PLUGIN_OK;
 }
 
+void CLunaticoBeaver::setMotionTarget(double dAz)
+{
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    m_MotionModel.SetTarget(dAz, steadyNow());
+}
 
-void CLunaticoBeaver::enableRainStatusFile(bool bEnable)
+void CLunaticoBeaver::setMotionPosition(double dAz)
 {
-    m_bSaveRainStatus = bEnable;
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    m_MotionModel.SetPosition(dAz, steadyNow());
 }
 
-void CLunaticoBeaver::getRainStatusFileName(std::string &fName)
+// Only used while the poller keeps feeding samples, otherwise the model would drift.
+bool CLunaticoBeaver::getPredictedAz(double &dAz)
 {
-    fName.assign(m_sRainStatusfilePath);
+    if(!m_bPollerRunning || m_bCalibrating)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    return m_MotionModel.Predict(steadyNow(), dAz);
+}
+
+// seconds to reach the motion model target from the last sample, -1 if unknown
+double CLunaticoBeaver::getMotionTime()
+{
+    std::lock_guard<std::mutex> lock(m_MotionMutex);
+    return m_MotionModel.TimeToTarget();
+}
+
+#pragma mark - goto tolerance
+
+// statistics saved by X2Dome, see CGotoTolerance::Serialize
+bool CLunaticoBeaver::setGotoToleranceStats(const std::string &sStats)
+{
+    return m_GotoTolerance.Deserialize(sStats);
+}
+
+// false if nothing changed since the last call
+bool CLunaticoBeaver::getGotoToleranceStats(std::string &sStats)
+{
+    if(!m_GotoTolerance.TakeChanged())
+        return false;
+    m_GotoTolerance.Serialize(sStats);
+    return true;
+}
+
+void CLunaticoBeaver::getGotoTolerance(double &dTolerance, unsigned long &nGotos)
+{
+    dTolerance = m_GotoTolerance.GetOverall();
+    nGotos = m_GotoTolerance.GetSamples();
+}
+
+void CLunaticoBeaver::resetGotoTolerance()
+{
+    m_GotoTolerance.Reset();
+}
+
+#pragma mark - tracking deadband
+
+void CLunaticoBeaver::setTrackingDeadband(double dSlitWidth, int nDeadband, int nLead)
+{
+    double dMaxTolerance = TOLERANCE_MAX;
+
+    std::lock_guard<std::mutex> lock(m_DeadbandMutex);
+    m_TrackingDeadband.Configure(dSlitWidth, nDeadband, nLead);
+    // a goto error on top of the deadband the telescope may already be off by has to stay within half the slit
+    if(m_TrackingDeadband.GetSlitWidth() > 0)
+        dMaxTolerance = std::min(dMaxTolerance, m_TrackingDeadband.GetSlitWidth() / 2.0 - m_TrackingDeadband.GetDeadband());
+    m_GotoTolerance.SetMaxTolerance(dMaxTolerance);
+    PLUGIN_LOG(LOG_INFO, LOG_UI) << " [setTrackingDeadband] slit width : " << std::fixed << std::setprecision(2) << m_TrackingDeadband.GetSlitWidth() << " , deadband : " << m_TrackingDeadband.GetDeadband() << " , lead : " << m_TrackingDeadband.GetLead() << " , max goto tolerance : " << dMaxTolerance << std::endl;
+}
+
+void CLunaticoBeaver::getTrackingDeadbandStats(unsigned long &nIssued, unsigned long &nSuppressed)
+{
+    std::lock_guard<std::mutex> lock(m_DeadbandMutex);
+    m_TrackingDeadband.GetStats(nIssued, nSuppressed);
+}
+
+#pragma mark - move ETA
+
+void CLunaticoBeaver::startMoveETA(int nMove, double dPredicted)
+{
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    m_MoveETA[nMove].Start(dPredicted, steadyNow());
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [startMoveETA] move " << nMove << " predicted : " << std::fixed << std::setprecision(2) << dPredicted << " s , ETA : " << m_MoveETA[nMove].GetEstimate() << " s" << std::endl;
+}
+
+void CLunaticoBeaver::completeMoveETA(int nMove)
+{
+    long long nNow = steadyNow();
+
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    PLUGIN_LOG(LOG_DEBUG, LOG_STATE) << " [completeMoveETA] move " << nMove << " ETA : " << std::fixed << std::setprecision(2) << m_MoveETA[nMove].GetEstimate() << " s , late by : " << -m_MoveETA[nMove].Remaining(nNow) << " s" << std::endl;
+    m_MoveETA[nMove].Complete(nNow);
+}
+
+void CLunaticoBeaver::stopMoveETA(int nMove)
+{
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    m_MoveETA[nMove].Stop();
 }
 
-void CLunaticoBeaver::writeRainStatus()
+// false while it's too early to bother the controller about this move
+bool CLunaticoBeaver::isMoveCheckDue(int nMove)
 {
     int nStatus;
+    double dAz;
 
-#ifdef PLUGIN_DEBUG
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus]" << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] m_bSaveRainStatus : " << (m_bSaveRainStatus?"YES":"NO") << std::endl;
-    m_sLogFile.flush();
-#endif
+    // answered from the poller snapshot, that costs nothing
+    if(getStatusSnapshot(nStatus, dAz))
+        return true;
 
-    if(m_bSaveRainStatus) {
-        getRainSensorStatus(nStatus);
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] m_nRainStatus      : " << m_nRainStatus << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] m_nRainSensorstate : " << m_nRainSensorstate << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] nStatus            : " << nStatus << std::endl;
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] nStatus            : " << (nStatus==RAINING?"Raining":"Not Raining") << std::endl;
-        m_sLogFile.flush();
-#endif
-        if(m_nRainStatus != nStatus) {
-#ifdef PLUGIN_DEBUG
-            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] state changed, wrinting new status : " << (nStatus==RAINING?"Raining":"Not Raining") << std::endl;
-            m_sLogFile.flush();
-#endif
-            m_nRainStatus = nStatus;
-            if(m_RainStatusfile.is_open())
-                m_RainStatusfile.close();
-            try {
-                m_RainStatusfile.open(m_sRainStatusfilePath, std::ios::out |std::ios::trunc);
-                if(m_RainStatusfile.is_open()) {
-                    m_RainStatusfile << "Raining:" << (nStatus == RAINING?"YES":"NO") << std::endl;
-                    m_RainStatusfile.close();
-                }
-            }
-            catch(const std::exception& e) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [writeRainStatus] Error writing file = " << e.what() << std::endl;
-                m_sLogFile.flush();
-#endif
-                if(m_RainStatusfile.is_open())
-                    m_RainStatusfile.close();
-            }
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    return m_MoveETA[nMove].IsCheckDue(steadyNow());
+}
+
+void CLunaticoBeaver::scheduleMoveCheck(int nMove)
+{
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    if(m_MoveETA[nMove].IsActive())
+        m_MoveETA[nMove].ScheduleNextCheck(steadyNow());
+}
+
+// seconds to the expected end of the move, -1 if it isn't moving or we can't tell yet.
+double CLunaticoBeaver::getMoveETA(int nMove)
+{
+    if(nMove < 0 || nMove >= MOVE_TYPES)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    return m_MoveETA[nMove].Remaining(steadyNow());
+}
+
+// what was learned from the past moves, for diagnostics
+void CLunaticoBeaver::getMoveHistory(int nMove, unsigned long &nMoves, double &dAvgDuration, double &dRatio)
+{
+    nMoves = 0;
+    dAvgDuration = 0;
+    dRatio = 1;
+    if(nMove < 0 || nMove >= MOVE_TYPES)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_ETAMutex);
+    nMoves = m_MoveETA[nMove].GetMoves();
+    dAvgDuration = m_MoveETA[nMove].GetAvgDuration();
+    dRatio = m_MoveETA[nMove].GetRatio();
+}
+
+#pragma mark - response cache
+
+// Freshness of the cached responses, in ms. Commands not listed here are never cached.
+static const struct {
+    const char *pszCmd;
+    int         nTTL;
+} CommandTTLs[] = {
+    {"!dome status#",                   CACHE_TTL_SHORT},
+    {"!dome getaz#",                    CACHE_TTL_SHORT},
+    {"!domerot gethome#",               CACHE_TTL_LONG},
+    {"!domerot getpark#",               CACHE_TTL_LONG},
+    {"!domerot getminspeed#",           CACHE_TTL_LONG},
+    {"!domerot getmaxspeed#",           CACHE_TTL_LONG},
+    {"!domerot getacceleration#",       CACHE_TTL_LONG},
+    {"!dome getshutterminspeed#",       CACHE_TTL_LONG},
+    {"!dome getshuttermaxspeed#",       CACHE_TTL_LONG},
+    {"!dome getshutteracceleration#",   CACHE_TTL_LONG},
+    {"!dome getshutterenable#",         CACHE_TTL_LONG},
+    {"!seletek version#",               CACHE_TTL_LONG},
+};
+
+int CLunaticoBeaver::getCommandTTL(const std::string &sCmd)
+{
+    for(size_t i = 0; i < sizeof(CommandTTLs)/sizeof(CommandTTLs[0]); i++) {
+        if(sCmd.compare(CommandTTLs[i].pszCmd) == 0)
+            return CommandTTLs[i].nTTL;
+    }
+    return 0;
+}
+
+// getxxx, status, athome and version only read from the controller.
+int CLunaticoBeaver::getCommandPriority(const std::string &sCmd)
+{
+    if(sCmd.compare(0, 11, "!dome abort") == 0)
+        return PRIORITY_ABORT;
+    if(!isQueryCommand(sCmd))
+        return PRIORITY_MOTION;
+    // versions and the slow relayed shutter queries can wait for everything else
+    if(sCmd.find("version#") != std::string::npos || sCmd.find("sendtoshutter") != std::string::npos)
+        return PRIORITY_DIAGNOSTIC;
+    return PRIORITY_STATUS;
+}
+
+// called with the port locked, right after the command bytes were written. Judged by
+// the verb, not the lane it went through : the rain reaction sends its moves as aborts.
+void CLunaticoBeaver::commandWritten(const std::string &sCmd)
+{
+    int nClass = getCommandPriority(sCmd);
+
+    if(nClass == PRIORITY_MOTION) {
+        m_nMotionCmdCount++;
+    }
+    else if(nClass == PRIORITY_ABORT) {
+        m_nAbortedMotionCount = m_nMotionCmdCount.load();
+        if(m_nAbortRequestTime) {
+            std::lock_guard<std::mutex> lock(m_StatsMutex);
+            m_AbortLatency.Add((unsigned long long)((steadyNow() - m_nAbortRequestTime) / 1000));
         }
+        m_nAbortRequestTime = 0;
     }
 }
 
+bool CLunaticoBeaver::isRelayCommand(const std::string &sCmd)
+{
+    static const char *pszRelayPrefix = "!dome sendtoshutter ";
+
+    return sCmd.compare(0, strlen(pszRelayPrefix), pszRelayPrefix) == 0;
+}
 
-int CLunaticoBeaver::parseFields(std::string sResp, std::vector<std::string> &svFields, char cSeparator)
+bool CLunaticoBeaver::isQueryCommand(const std::string &sCmd)
 {
-    int nErr = PLUGIN_OK;
-    std::string sSegment;
-    std::string sTmp;
-    
-    sResp = trim(sResp,"!#\r\n");
-    if(!sResp.size()) {
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseFields] sResp is empty." << std::endl;
-        m_sLogFile.flush();
-#endif
-        return ERR_CMDFAILED;
+    static const char *pszQuerySuffixes[] = {"status", "athome", "version"};
+    size_t nEnd;
+
+    if(sCmd.find(" get") != std::string::npos)
+        return true;
+
+    // relayed commands end in "\"#", with or without a '#' of their own inside the quotes
+    nEnd = sCmd.find_last_not_of("#\"");
+    if(nEnd == std::string::npos)
+        return false;
+    nEnd++;
+    for(size_t i = 0; i < sizeof(pszQuerySuffixes)/sizeof(pszQuerySuffixes[0]); i++) {
+        size_t nLen = strlen(pszQuerySuffixes[i]);
+        if(nEnd >= nLen && sCmd.compare(nEnd - nLen, nLen, pszQuerySuffixes[i]) == 0)
+            return true;
     }
-    
-    std::stringstream ssTmp(sResp);
+    return false;
+}
 
-    svFields.clear();
-    // split the string into vector elements
-    while(std::getline(ssTmp, sSegment, cSeparator))
-    {
-        svFields.push_back(sSegment);
+bool CLunaticoBeaver::getCachedResponse(const std::string &sCmd, std::string &sResp)
+{
+    std::map<std::string, CachedResponse>::iterator it;
+    int nTTL;
+
+    nTTL = getCommandTTL(sCmd);
+    if(!nTTL)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_CacheMutex);
+    it = m_CachedResponses.find(sCmd);
+    if(it == m_CachedResponses.end() || !it->second.nTime || steadyNow() - it->second.nTime > nTTL * 1000000LL) {
+        m_nCacheMisses++;
+        if(it != m_CachedResponses.end())
+            it->second.nMisses++;
+        return false;
     }
 
-    if(svFields.size()==0) {
-#ifdef PLUGIN_DEBUG
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [parseFields] no field found in : '" << sResp << "'" << std::endl;
-        m_sLogFile.flush();
-#endif
-        nErr = ERR_CMDFAILED;
+    sResp.assign(it->second.sResp);
+    it->second.nHits++;
+    m_nCacheHits++;
+    return true;
+}
+
+void CLunaticoBeaver::cacheResponse(const std::string &sCmd, const std::string &sResp)
+{
+    if(!getCommandTTL(sCmd))
+        return;
+
+    std::lock_guard<std::mutex> lock(m_CacheMutex);
+    CachedResponse &Entry = m_CachedResponses[sCmd];
+    if(!Entry.nTime && !Entry.nHits && !Entry.nMisses)
+        Entry.nMisses = 1;  // first request for this command
+    Entry.sResp.assign(sResp);
+    Entry.nTime = steadyNow();
+}
+
+// Entries are only marked stale so their buffers and counters are kept.
+void CLunaticoBeaver::clearResponseCache()
+{
+    std::map<std::string, CachedResponse>::iterator it;
+
+    std::lock_guard<std::mutex> lock(m_CacheMutex);
+    for(it = m_CachedResponses.begin(); it != m_CachedResponses.end(); ++it)
+        it->second.nTime = 0;
+}
+
+void CLunaticoBeaver::getCacheStats(unsigned long &nHits, unsigned long &nMisses)
+{
+    nHits = m_nCacheHits;
+    nMisses = m_nCacheMisses;
+}
+
+void CLunaticoBeaver::logCacheStats()
+{
+    std::map<std::string, CachedResponse>::iterator it;
+
+    if(!isLogEnabled(LOG_DEBUG, LOG_TRANSPORT))
+        return;
+
+    std::lock_guard<std::mutex> lock(m_CacheMutex);
+    PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [logCacheStats] hits : " << m_nCacheHits << " , misses : " << m_nCacheMisses << std::endl;
+    for(it = m_CachedResponses.begin(); it != m_CachedResponses.end(); ++it)
+        PLUGIN_LOG(LOG_DEBUG, LOG_TRANSPORT) << " [logCacheStats] " << it->first << " hits : " << it->second.nHits << " , misses : " << it->second.nMisses << std::endl;
+}
+
+#pragma mark - command statistics
+
+// "!domerot setminspeed 100#" is tracked as "domerot setminspeed" and
+// "!dome sendtoshutter "shutter getvoltage"#" as "shutter getvoltage" in the shutter stats.
+void CLunaticoBeaver::recordCommandLatency(const std::string &sCmd, long long nUs, int nErr)
+{
+    static const char *pszShutterPrefix = "!dome sendtoshutter \"";
+    const char *pszVerb = sCmd.c_str();
+    bool bShutter = false;
+    int nWords = 0;
+    size_t nLen;
+
+    if(strncmp(pszVerb, pszShutterPrefix, strlen(pszShutterPrefix)) == 0) {
+        pszVerb += strlen(pszShutterPrefix);
+        bShutter = true;
+    }
+    else if(*pszVerb == '!')
+        pszVerb++;
+
+    // first two words
+    for(nLen = 0; pszVerb[nLen] && pszVerb[nLen] != '#' && pszVerb[nLen] != '"'; nLen++) {
+        if(pszVerb[nLen] == ' ' && ++nWords == 2)
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    m_sStatsVerb.assign(pszVerb, nLen);
+    CLatencyHistogram &Histogram = bShutter ? m_ShutterCmdLatency[m_sStatsVerb] : m_DomeCmdLatency[m_sStatsVerb];
+
+    if(nErr == PLUGIN_OK) {
+        Histogram.Add(nUs > 0 ? (unsigned long long)nUs : 0);
+        if(bShutter)
+            m_ShutterLinkLatency.Add(nUs > 0 ? (unsigned long long)nUs : 0);
+    }
+    else if(nErr == COMMAND_TIMEOUT || nErr == ERR_RXTIMEOUT) {
+        Histogram.AddTimeout();
+        if(bShutter)
+            m_ShutterLinkLatency.AddTimeout();
+    }
+    else {
+        Histogram.AddError();
+        if(bShutter)
+            m_ShutterLinkLatency.AddError();
+    }
+}
+
+void CLunaticoBeaver::getCommandStats(std::vector<CommandLatency> &Stats)
+{
+    std::map<std::string, CLatencyHistogram>::iterator it;
+    CommandLatency Latency;
+
+    Stats.clear();
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    for(int i = 0; i < 2; i++) {
+        std::map<std::string, CLatencyHistogram> &Histograms = (i == 0) ? m_DomeCmdLatency : m_ShutterCmdLatency;
+        for(it = Histograms.begin(); it != Histograms.end(); ++it) {
+            Latency.sVerb = it->first;
+            Latency.bShutter = (i == 1);
+            Latency.nCount = it->second.GetCount();
+            Latency.nTimeouts = it->second.GetTimeouts();
+            Latency.nErrors = it->second.GetErrors();
+            Latency.nP50Us = it->second.GetPercentileUs(50);
+            Latency.nP99Us = it->second.GetPercentileUs(99);
+            Latency.nMaxUs = it->second.GetMaxUs();
+            Stats.push_back(Latency);
+        }
     }
-    return nErr;
 }
 
+void CLunaticoBeaver::resetCommandStats()
+{
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    m_DomeCmdLatency.clear();
+    m_ShutterCmdLatency.clear();
+    m_AbortLatency.Reset();
+    m_ShutterLinkLatency.Reset();
+    m_ShutterLink.ResetStats();
+}
 
-std::string& CLunaticoBeaver::trim(std::string &str, const std::string& filter )
+void CLunaticoBeaver::getAbortStats(CommandLatency &Latency, unsigned long &nDroppedPolls)
 {
-    return ltrim(rtrim(str, filter), filter);
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    Latency.sVerb = "abort";
+    Latency.bShutter = false;
+    Latency.nCount = m_AbortLatency.GetCount();
+    Latency.nTimeouts = 0;
+    Latency.nErrors = 0;
+    Latency.nP50Us = m_AbortLatency.GetPercentileUs(50);
+    Latency.nP99Us = m_AbortLatency.GetPercentileUs(99);
+    Latency.nMaxUs = m_AbortLatency.GetMaxUs();
+    nDroppedPolls = m_nDroppedPolls;
 }
 
-std::string& CLunaticoBeaver::ltrim(std::string& str, const std::string& filter)
+void CLunaticoBeaver::setShutterLinkBudget(int nPerMinute)
 {
-    str.erase(0, str.find_first_not_of(filter));
-    return str;
+    m_ShutterLink.SetBudget(nPerMinute);
 }
 
-std::string& CLunaticoBeaver::rtrim(std::string& str, const std::string& filter)
+void CLunaticoBeaver::getShutterLinkStats(ShutterLinkStats &Stats, CommandLatency &Latency)
 {
-    str.erase(str.find_last_not_of(filter) + 1);
-    return str;
+    m_ShutterLink.GetStats(Stats, steadyNow());
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    Latency.sVerb = "sendtoshutter";
+    Latency.bShutter = true;
+    Latency.nCount = m_ShutterLinkLatency.GetCount();
+    Latency.nTimeouts = m_ShutterLinkLatency.GetTimeouts();
+    Latency.nErrors = m_ShutterLinkLatency.GetErrors();
+    Latency.nP50Us = m_ShutterLinkLatency.GetPercentileUs(50);
+    Latency.nP99Us = m_ShutterLinkLatency.GetPercentileUs(99);
+    Latency.nMaxUs = m_ShutterLinkLatency.GetMaxUs();
 }
 
-#ifdef PLUGIN_DEBUG
-const std::string CLunaticoBeaver::getTimeStamp()
+// called with the port locked, false if the relayed queries in svCmds are over the budget
+bool CLunaticoBeaver::acquireRelayBudget(const std::vector<std::string> &svCmds)
+{
+    int nMessages = 0;
+    bool bChange = false;
+
+    for(size_t i = 0; i < svCmds.size(); i++) {
+        if(!isRelayCommand(svCmds[i]))
+            continue;
+        nMessages++;
+        if(!isQueryCommand(svCmds[i]))
+            bChange = true;
+    }
+    return !nMessages || m_ShutterLink.Acquire(nMessages, bChange, steadyNow());
+}
+
+void CLunaticoBeaver::logCommandStats()
+{
+    std::vector<CommandLatency> Stats;
+    char szLine[LOG_LINE_SIZE];
+    unsigned long nIssued;
+    unsigned long nSuppressed;
+    CommandLatency AbortLatency;
+    unsigned long nDroppedPolls;
+    ShutterLinkStats LinkStats;
+    CommandLatency LinkLatency;
+
+    if(!m_pLogger)
+        return;
+
+    getCommandStats(Stats);
+    if(Stats.empty())
+        return;
+
+    getTrackingDeadbandStats(nIssued, nSuppressed);
+    if(nSuppressed) {
+        snprintf(szLine, LOG_LINE_SIZE, "[LunaticoBeaver] gotos : %lu sent , %lu within the tracking deadband", nIssued, nSuppressed);
+        m_pLogger->out(szLine);
+    }
+    getAbortStats(AbortLatency, nDroppedPolls);
+    if(AbortLatency.nCount) {
+        snprintf(szLine, LOG_LINE_SIZE, "[LunaticoBeaver] abort request to write (us) : %lu %llu %llu %llu , %lu polls dropped",
+                 AbortLatency.nCount, AbortLatency.nP50Us, AbortLatency.nP99Us, AbortLatency.nMaxUs, nDroppedPolls);
+        m_pLogger->out(szLine);
+    }
+    getShutterLinkStats(LinkStats, LinkLatency);
+    if(LinkStats.nSent || LinkStats.nRefused) {
+        snprintf(szLine, LOG_LINE_SIZE, "[LunaticoBeaver] shutter link : %lu sent , %lu merged , %lu over the %d/min budget , round trip (us) %llu %llu %llu",
+                 LinkStats.nSent, LinkStats.nMerged, LinkStats.nRefused, LinkStats.nBudget, LinkLatency.nP50Us, LinkLatency.nP99Us, LinkLatency.nMaxUs);
+        m_pLogger->out(szLine);
+    }
+    m_pLogger->out("[LunaticoBeaver] command latency (us) : count p50 p99 max timeouts errors");
+    for(size_t i = 0; i < Stats.size(); i++) {
+        snprintf(szLine, LOG_LINE_SIZE, "[LunaticoBeaver] %s%s : %lu %llu %llu %llu %lu %lu",
+                 Stats[i].bShutter ? "(shutter) " : "", Stats[i].sVerb.c_str(),
+                 Stats[i].nCount, Stats[i].nP50Us, Stats[i].nP99Us, Stats[i].nMaxUs,
+                 Stats[i].nTimeouts, Stats[i].nErrors);
+        m_pLogger->out(szLine);
+    }
+}
+
+#pragma mark - response parsing
+
+// Points pszField at the value following cSeparator in a "!cmd:value" response.
+// Nothing is copied, the field stays valid as long as sResp is not modified.
+int CLunaticoBeaver::getResponseField(const std::string &sResp, const char *&pszField, size_t &nFieldLen, char cSeparator)
 {
+    const char *pszStart = sResp.c_str();
+    const char *pszEnd = pszStart + sResp.size();
+    const char *pszSep;
+
+    pszSep = (const char *)memchr(pszStart, cSeparator, sResp.size());
+    if(!pszSep)
+        return ERR_CMDFAILED;
+
+    pszField = pszSep + 1;
+    // only keep the field up to the next separator, if any
+    pszSep = (const char *)memchr(pszField, cSeparator, pszEnd - pszField);
+    if(pszSep)
+        pszEnd = pszSep;
+    while(pszEnd > pszField && (*(pszEnd-1) == '#' || *(pszEnd-1) == '\r' || *(pszEnd-1) == '\n' || *(pszEnd-1) == ' '))
+        pszEnd--;
+    while(pszField < pszEnd && *pszField == ' ')
+        pszField++;
+
+    nFieldLen = pszEnd - pszField;
+    return PLUGIN_OK;
+}
+
+// locale independent decimal conversion, no allocation.
+int CLunaticoBeaver::parseValue(const std::string &sResp, double &dValue, char cSeparator)
+{
+    const char *pszField;
+    const char *pszEnd;
+    size_t nFieldLen;
+    bool bNegative = false;
+    bool bDigits = false;
+    long long nMantissa = 0;
+    int nScale = 0;
+    int nExponent = 0;
+    bool bNegativeExponent = false;
+    double dScale;
+
+    if(getResponseField(sResp, pszField, nFieldLen, cSeparator))
+        return ERR_CMDFAILED;
+    pszEnd = pszField + nFieldLen;
+
+    if(pszField < pszEnd && (*pszField == '-' || *pszField == '+'))
+        bNegative = (*pszField++ == '-');
+
+    for(; pszField < pszEnd && isdigit((unsigned char)*pszField); pszField++) {
+        bDigits = true;
+        if(nMantissa < 100000000000000000LL)
+            nMantissa = nMantissa*10 + (*pszField - '0');
+        else
+            nScale++;   // too many digits, drop the least significant ones
+    }
+    if(pszField < pszEnd && *pszField == '.') {
+        for(pszField++; pszField < pszEnd && isdigit((unsigned char)*pszField); pszField++) {
+            bDigits = true;
+            if(nMantissa < 100000000000000000LL) {
+                nMantissa = nMantissa*10 + (*pszField - '0');
+                nScale--;
+            }
+        }
+    }
+    if(!bDigits)
+        return ERR_CMDFAILED;
+
+    if(pszField < pszEnd && (*pszField == 'e' || *pszField == 'E')) {
+        pszField++;
+        if(pszField < pszEnd && (*pszField == '-' || *pszField == '+'))
+            bNegativeExponent = (*pszField++ == '-');
+        for(; pszField < pszEnd && isdigit((unsigned char)*pszField) && nExponent < 1000; pszField++)
+            nExponent = nExponent*10 + (*pszField - '0');
+        nScale += bNegativeExponent ? -nExponent : nExponent;
+    }
+
+    dValue = double(nMantissa);
+    dScale = 1.0;
+    for(int i = 0; i < abs(nScale) && i < 400; i++)
+        dScale *= 10.0;
+    if(nScale < 0)
+        dValue /= dScale;
+    else
+        dValue *= dScale;
+    if(bNegative)
+        dValue = -dValue;
+
+    return PLUGIN_OK;
+}
+
+int CLunaticoBeaver::parseValue(const std::string &sResp, int &nValue, char cSeparator)
+{
+    const char *pszField;
+    const char *pszEnd;
+    size_t nFieldLen;
+    bool bNegative = false;
+    bool bDigits = false;
+    long long nTmp = 0;
+
+    if(getResponseField(sResp, pszField, nFieldLen, cSeparator))
+        return ERR_CMDFAILED;
+    pszEnd = pszField + nFieldLen;
+
+    if(pszField < pszEnd && (*pszField == '-' || *pszField == '+'))
+        bNegative = (*pszField++ == '-');
+
+    // like stoi, stop at the first non digit (a decimal point for example)
+    for(; pszField < pszEnd && isdigit((unsigned char)*pszField); pszField++) {
+        bDigits = true;
+        nTmp = nTmp*10 + (*pszField - '0');
+        if(nTmp > 0x7FFFFFFFLL)
+            return ERR_CMDFAILED;
+    }
+    if(!bDigits)
+        return ERR_CMDFAILED;
+
+    nValue = int(bNegative ? -nTmp : nTmp);
+    return PLUGIN_OK;
+}
+
+#pragma mark - logging
+
+// nLevel is one of LOG_OFF, LOG_INFO, LOG_DEBUG, LOG_TRACE. nCategories is a mask of
+// LOG_TRANSPORT, LOG_STATE, LOG_RAIN and LOG_UI. The log file is only created the first
+// time logging is enabled.
+void CLunaticoBeaver::setLogLevel(int nLevel, int nCategories)
+{
+    unsigned int nFilter = 0;
+
+    nLevel = std::max(int(LOG_OFF), std::min(nLevel, int(LOG_TRACE)));
+    nCategories &= LOG_ALL;
+
+    if(nLevel > LOG_OFF && !m_sLogFile.is_open()) {
+        m_sLogFile.open(m_sLogfilePath);
+        m_sLogFile << "[" << getTimeStamp() << "]" << " [CLunaticoBeaver] Version " << std::fixed << std::setprecision(2) << PLUGIN_VERSION << " build " << __DATE__ << " " << __TIME__ << std::endl;
+    }
+
+    for(int i = LOG_INFO; i <= nLevel; i++)
+        nFilter |= LOG_FILTER_BIT(i, nCategories);
+
+    m_nLogLevel = nLevel;
+    m_nLogCategories = nCategories;
+    // release : a thread that sees the new filter also sees the log file opened above
+    m_nLogFilter.store(nFilter, std::memory_order_release);
+
+    PLUGIN_LOG(LOG_INFO, LOG_UI) << " [setLogLevel] level : " << nLevel << " , categories : 0x" << std::hex << nCategories << std::endl;
+}
+
+int CLunaticoBeaver::getLogLevel()
+{
+    return m_nLogLevel;
+}
+
+int CLunaticoBeaver::getLogCategories()
+{
+    return m_nLogCategories;
+}
+
+// localtime and strftime only run once per second and per thread, the
+// string is kept in a thread local buffer that stays valid until the next call.
+const char *CLunaticoBeaver::getTimeStamp()
+{
+    static thread_local time_t nLastStamp = 0;
+    static thread_local char szStamp[80];
     time_t     now = time(0);
     struct tm  tstruct;
-    char       buf[80];
-    tstruct = *localtime(&now);
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d.%X", &tstruct);
 
-    return buf;
-}
+    if(now != nLastStamp) {
+#if defined(SB_WIN_BUILD)
+        localtime_s(&tstruct, &now);
+#else
+        localtime_r(&now, &tstruct);
 #endif
+        std::strftime(szStamp, sizeof(szStamp), "%Y-%m-%d.%X", &tstruct);
+        nLastStamp = now;
+    }
+    return szStamp;
+}
@@ -21,27 +21,73 @@
 // C++ includes
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
 
 // SB includes
 #include "../../licensedinterfaces/sberrorx.h"
 #include "../../licensedinterfaces/serxinterface.h"
+#include "../../licensedinterfaces/loggerinterface.h"
 
 #include "StopWatch.h"
+#include "LatencyHistogram.h"
+#include "AsyncLogger.h"
+#include "DomeMotionModel.h"
+#include "MoveETA.h"
+#include "GotoTolerance.h"
+#include "SlewPlanner.h"
+#include "TrackingDeadband.h"
+#include "PriorityLock.h"
+#include "RainWatcher.h"
+#include "RainStatusFile.h"
+#include "Telemetry.h"
+#include "BatteryCache.h"
+#include "ShutterLink.h"
 
 #define SERIAL_BUFFER_SIZE 256
 #define MAX_TIMEOUT 500
-#define MAX_READ_WAIT_TIMEOUT 25
 #define ND_LOG_BUFFER_SIZE 256
-#define RAIN_CHECK_INTERVAL 10
+#define STATUS_POLL_INTERVAL 500    // ms, 0 disables the background status poller unless a rain reaction or the rain file needs it
+#define STATUS_POLL_MIN_INTERVAL 100
+#define CACHE_TTL_SHORT     100     // ms, status and position
+#define CACHE_TTL_LONG      60000   // ms, values that only change when we set them
+#define STATS_LOG_INTERVAL  600     // seconds between command latency dumps to the TheSkyX log
+#define LOG_LINE_SIZE       256
+
+// runtime log levels
+#define LOG_OFF             0
+#define LOG_INFO            1
+#define LOG_DEBUG           2
+#define LOG_TRACE           3
+// log categories
+#define LOG_TRANSPORT       0x01    // serial commands, responses, cache
+#define LOG_STATE           0x02    // dome and shutter state machine
+#define LOG_RAIN            0x04
+#define LOG_UI              0x08    // settings and configuration
+#define LOG_ALL             0x0F
+
+// one byte of the filter per level, one bit per category, so a disabled
+// log statement costs a load, a test against a constant and a branch.
+// The stream arguments are not evaluated when the statement is disabled.
+#define LOG_FILTER_BIT(nLevel, nCategory)   ((unsigned int)(nCategory) << (((nLevel) - 1) * 8))
+// PLUGIN_NO_LOG compiles the log statements out, for builds that never log.
+#ifdef PLUGIN_NO_LOG
+#define PLUGIN_LOG(nLevel, nCategory)       if(true) {} else m_sLogFile << "[" << getTimeStamp() << "]"
+#else
+#define PLUGIN_LOG(nLevel, nCategory)       if(!isLogEnabled(nLevel, nCategory)) {} else m_sLogFile << "[" << getTimeStamp() << "]"
+#endif
 
-// #define PLUGIN_DEBUG 2
+// #define PLUGIN_DEBUG 2    // default runtime log level, see setLogLevel
 #define PLUGIN_VERSION      1.4
 
 /* dome status
@@ -81,10 +127,54 @@
 
 // error codes
 // Error code
-enum DomeErrors {PLUGIN_OK=0, NOT_CONNECTED, PLUGIN_CANT_CONNECT, PLUGIN_BAD_CMD_RESPONSE, COMMAND_FAILED, COMMAND_TIMEOUT};
+enum DomeErrors {PLUGIN_OK=0, NOT_CONNECTED, PLUGIN_CANT_CONNECT, PLUGIN_BAD_CMD_RESPONSE, COMMAND_FAILED, COMMAND_TIMEOUT, SHUTTER_LINK_BUSY};
 enum DomeShutterState {OPEN = 0, CLOSED, OPENING, CLOSING, SHUTTER_ERROR };
 enum HomeStatuses {NOT_HOME = 0, AT_HOME};
 enum RainActions {DO_NOTHING=0, HOME, PARK};
+enum DomeMoves {MOVE_GOTO = 0, MOVE_OPEN, MOVE_CLOSE, MOVE_PARK, MOVE_TYPES};
+// serial port access, most urgent first
+enum CommandPriorities {PRIORITY_FROM_VERB = -1, PRIORITY_ABORT = 0, PRIORITY_MOTION, PRIORITY_STATUS, PRIORITY_DIAGNOSTIC};
+
+// decoded "!dome status#" bitfield
+struct DomeStatus {
+    int     nRaw;
+    bool    bDomeMoving;
+    bool    bShutterMoving;
+    bool    bDomeMechError;
+    bool    bShutterMechError;
+    bool    bShutterComError;
+    bool    bRaining;
+    int     nShutterState;  // DomeShutterState, SHUTTER_ERROR if no shutter bit is set
+    bool    bAtHome;
+    bool    bAtPark;
+};
+
+// controller settings edited in the settings dialog
+struct DomeSettings {
+    double  dHomeAz = 0;
+    double  dParkAz = 0;
+    int     nStepsPerRev = 0;
+    int     nRotMinSpeed = 0;
+    int     nRotMaxSpeed = 0;
+    int     nRotAccel = 0;
+    bool    bShutter = false;   // shutter values are only applied if set
+    int     nShutMinSpeed = 0;
+    int     nShutMaxSpeed = 0;
+    int     nShutAccel = 0;
+    double  dShutterCutOff = 0;
+};
+
+// latency of one command verb, times in microseconds
+struct CommandLatency {
+    std::string         sVerb;
+    bool                bShutter;   // relayed to the shutter by the dome controller
+    unsigned long       nCount;
+    unsigned long       nTimeouts;
+    unsigned long       nErrors;
+    unsigned long long  nP50Us;
+    unsigned long long  nP99Us;
+    unsigned long long  nMaxUs;
+};
 
 // RG-11
 enum RainSensorStates {RAINING= 0, NOT_RAINING, RAIN_UNNOWN};
@@ -100,6 +190,22 @@ public:
     const bool  IsConnected(void) { return m_bIsConnected; }
 
     void        setSerxPointer(SerXInterface *p) { m_pSerx = p; }
+    void        setLoggerPointer(LoggerInterface *p) { m_pLogger = p; }
+    void        setClock(CClock *pClock);
+
+    // expected end of the current moves, see DomeMoves
+    double      getMoveETA(int nMove);
+    void        getMoveHistory(int nMove, unsigned long &nMoves, double &dAvgDuration, double &dRatio);
+
+    // goto tolerance learned from past gotos
+    bool        setGotoToleranceStats(const std::string &sStats);
+    bool        getGotoToleranceStats(std::string &sStats);
+    void        getGotoTolerance(double &dTolerance, unsigned long &nGotos);
+    void        resetGotoTolerance();
+
+    // slaved tracking gotos that keep the telescope within the slit are not sent, see TrackingDeadband.h
+    void        setTrackingDeadband(double dSlitWidth, int nDeadband = DEADBAND_DEFAULT_PERCENT, int nLead = DEADBAND_LEAD_PERCENT);
+    void        getTrackingDeadbandStats(unsigned long &nIssued, unsigned long &nSuppressed);
 
     // Dome commands
     int syncDome(double dAz, double dEl);
@@ -126,6 +232,8 @@ public:
     int isCalibratingShutterComplete(bool &bComplete);
 
     int abortCurrentCommand();
+    // only sends the abort, ahead of any queued command. Safe to call from any thread.
+    int sendAbort();
     int getShutterPresent(bool &bShutterPresent);
     int setShutterPresent(bool bShutterPresent);
     int isShutterDetected(bool &bDetected);
@@ -144,30 +252,71 @@ public:
 
     double getCurrentAz();
     double getCurrentEl();
+    // lock free, from the status poller and the motion model. false when the
+    // caller has to go through getCurrentAz and getCurrentEl.
+    bool getCachedAzEl(double &dAz, double &dEl);
 
     int getCurrentShutterState();
     int getBatteryLevels(double &dShutterVolts, double &dShutterCutOff);
     int setBatteryCutOff(double dShutterCutOff);
 
     int getRainSensorStatus(int &nStatus);
+    // done by the status poller as soon as the rain is confirmed, see RainActions and RainWatcher.h.
+    // nSampleInterval (ms) caps the poll interval while a reaction is set.
+    void setRainReaction(int nAction, bool bCloseShutter, int nSampleInterval = RAIN_SAMPLE_INTERVAL, int nDebounce = RAIN_DEBOUNCE);
 
     int getRotationSpeed(int &nMinSpeed, int &nMaxSpeed, int &nAccel);
     int setRotationSpeed(int nMinSpeed, int nMaxSpeed, int nAccel);
 
     int getShutterSpeed(int &nMinSpeed, int &nMaxSpeed, int &nAccel);
     int setShutterSpeed(int nMinSpeed, int nMaxSpeed, int nAccel);
+
+    // rotation and shutter speeds in a single round trip
+    int getSpeeds(int &nRotMinSpeed, int &nRotMaxSpeed, int &nRotAccel, int &nShutMinSpeed, int &nShutMaxSpeed, int &nShutAccel);
+
+    // runtime logging to LunaticoBeaver-Log.txt
+    void setLogLevel(int nLevel, int nCategories = LOG_ALL);
+    int getLogLevel();
+    int getLogCategories();
+
+    // send the settings that differ from Current in one batch, followed by a save to eeprom
+    int applySettings(const DomeSettings &Current, const DomeSettings &New);
+
+    // response cache, set commands invalidate it
+    void clearResponseCache();
+    void getCacheStats(unsigned long &nHits, unsigned long &nMisses);
+
+    // per command latency, dome and shutter commands are tracked separately
+    void getCommandStats(std::vector<CommandLatency> &Stats);
+    void resetCommandStats();
+    // from the abort request to the abort bytes written, and the polls dropped for it
+    void getAbortStats(CommandLatency &Latency, unsigned long &nDroppedPolls);
+    void logCommandStats();
+
+    // messages relayed to the shutter, see ShutterLink.h. nPerMinute 0 is unlimited.
+    void setShutterLinkBudget(int nPerMinute);
+    void getShutterLinkStats(ShutterLinkStats &Stats, CommandLatency &Latency);
     
     void enableRainStatusFile(bool bEnable);
     void getRainStatusFileName(std::string &fName);
-    void writeRainStatus();
 
     int saveSettingsToEEProm();
 
+    // background status poller
+    void setStatusPollInterval(int nIntervalMs);
+    int getStatusPollInterval();
+
+    // shared memory telemetry for local tools while connected, see Telemetry.h
+    void enableTelemetry(bool bEnable);
+
 protected:
 
-    int             domeCommand(const std::string sCmd, std::string &sResp, int nTimeout = MAX_TIMEOUT);
+    int             domeCommand(const std::string sCmd, std::string &sResp, int nTimeout = MAX_TIMEOUT, int nPriority = PRIORITY_FROM_VERB);
     int             shutterCommand(const std::string sCmd, std::string &sResp, int nTimeout = MAX_TIMEOUT);
     int             readResponse(std::string &sResp, int nTimeout = MAX_TIMEOUT);
+    // send all commands at once and collect the responses in the same order
+    int             domeCommandBatch(const std::vector<std::string> &svCmds, std::vector<std::string> &svResps, int nTimeout = MAX_TIMEOUT, bool bUseCache = true, bool bDroppable = false);
+    int             getValues(const std::vector<std::string> &svCmds, std::vector<double> &dvValues);
     int             getDomeAz(double &dDomeAz);
     int             getDomeEl(double &dDomeEl);
     int             getDomeHomeAz(double &dAz);
@@ -176,31 +325,85 @@ protected:
     int             getDomeStepPerDeg(double &dStepPerDeg);
     int             setDomeStepPerDeg(double dStepPerDeg);
     int             getDomeStatus(int &nStatus);
+    int             getDomeStatus(DomeStatus &Status);
+    static void     decodeDomeStatus(int nStatus, DomeStatus &Status);
 
     int             setMaxRotationTime(int nSeconds);
 
     bool            isDomeMoving();
+    void            startStatusPoller();
+    void            stopStatusPoller();
+    void            statusPoller();
+    void            publishStatus(int nStatus, double dAz, long long nSampleTime);
+    void            updateTelemetryStatus(int nStatus, double dAz);
+    void            updateTelemetryAz(double dAz);
+    void            updateTelemetryBattery(double dShutterVolts, double dShutterCutOff);
+    int             refreshBatteryLevels(bool bDroppable = false);
+    int             readBatteryLevels(bool bDroppable);
+    bool            acquireRelayBudget(const std::vector<std::string> &svCmds);
+    void            checkBatteryRefresh(int nStatus);
+    void            updateTelemetryStats();
+    static int64_t  epochMicroseconds();
+    bool            getStatusSnapshot(int &nStatus, double &dAz);
+    void            markStateChanged();
+    int             updateMotionProfile();
+    void            setMotionTarget(double dAz);
+    void            setMotionPosition(double dAz);
+    bool            getPredictedAz(double &dAz);
+    double          getMotionTime();
+    // bRetry keeps the try count and the distance of the goto being corrected
+    int             startGoto(double dNewAz, bool bRetry = false);
+    int             sendGotoAz(double dAz);
+    void            planSlew(double dFromAz, double dToAz, SlewPlan &Plan);
+    void            checkGotoVia(bool bStopped);
+    void            startMoveETA(int nMove, double dPredicted);
+    void            completeMoveETA(int nMove);
+    void            stopMoveETA(int nMove);
+    bool            isMoveCheckDue(int nMove);
+    void            scheduleMoveCheck(int nMove);
+    int             getPollInterval();
+    int             getPollDelay();
+    bool            isRainReactionSet();
+    void            checkRain(int nStatus, long long nSampleTime);
+    void            runRainActions(int nStatus);
+    void            retryRainActions(int nStatus);
+    void            rainCloseShutter(bool bRetry);
+    void            rainMove(bool bRetry);
+    void            logRainEvent(const char *pszEvent, long long nOnset);
+    long long       steadyNow();
     bool            isDomeAtHome();
-    bool            checkBoundaries(double dGotoAz, double dDomeAz);
-
-    int             parseFields(std::string sResp, std::vector<std::string> &svFields, char cSeparator);
-    std::string&    trim(std::string &str, const std::string &filter );
-    std::string&    ltrim(std::string &str, const std::string &filter);
-    std::string&    rtrim(std::string &str, const std::string &filter);
+    bool            checkBoundaries(double dGotoAz, double dDomeAz, double dTolerance);
+
+    static int      getCommandTTL(const std::string &sCmd);
+    static bool     isQueryCommand(const std::string &sCmd);
+    static bool     isRelayCommand(const std::string &sCmd);
+    static int      getCommandPriority(const std::string &sCmd);
+    void            commandWritten(const std::string &sCmd);
+    bool            getCachedResponse(const std::string &sCmd, std::string &sResp);
+    void            cacheResponse(const std::string &sCmd, const std::string &sResp);
+    void            logCacheStats();
+    void            recordCommandLatency(const std::string &sCmd, long long nUs, int nErr);
+
+    int             getResponseField(const std::string &sResp, const char *&pszField, size_t &nFieldLen, char cSeparator = ':');
+    int             parseValue(const std::string &sResp, double &dValue, char cSeparator = ':');
+    int             parseValue(const std::string &sResp, int &nValue, char cSeparator = ':');
 
     SerXInterface   *m_pSerx;
+    CPriorityLock   m_PortLock;     // serialize access to the serial port between callers and the poller, see CommandPriorities
+    std::string     m_sRxBuffer;    // bytes received past the last '#' terminator
+    std::string     m_sTxBuffer;    // batched commands, reused between batches
+    std::vector<size_t> m_nvBatchSent;  // index of the batched commands that were not served from the cache
 
-    bool            m_bIsConnected;
-    bool            m_bParked;
-    bool            m_bShutterOpened;
-    bool            m_bCalibrating;
+    std::atomic<bool> m_bIsConnected;   // these three are also read by getCachedAzEl without any lock
+    std::atomic<bool> m_bParked;        // the park state is also changed by the rain reaction on the status poller
+    std::atomic<bool> m_bShutterOpened;
+    std::atomic<bool> m_bCalibrating;
 
     double          m_dStepsPerDeg;
     int             m_nNbStepPerRev;
     double          m_dShutterBatteryVolts;
-    double          m_dHomeAz;
-
-    double          m_dParkAz;
+    std::atomic<double> m_dHomeAz;      // read by the rain reaction on the status poller
+    std::atomic<double> m_dParkAz;
 
     double          m_dCurrentAzPosition;
     double          m_dCurrentElPosition;
@@ -210,10 +413,11 @@ protected:
     std::string     m_sFirmwareVersion;
     int             m_nShutterState;
     bool            m_bShutterOnly; // roll off roof so the arduino is running the shutter firmware only.
-    int             m_nHomingTries;
+    std::atomic<int>  m_nHomingTries;
     int             m_nGotoTries;
-    bool            m_bParking;
-    bool            m_bUnParking;
+    std::atomic<bool> m_bParking;
+    std::atomic<bool> m_bUnParking;
+    std::atomic<bool> m_bGotoCancelled; // the rain reaction took the dome somewhere else
     int             m_nRainSensorstate;
     bool            m_bHomeOnPark;
     bool            m_bHomeOnUnpark;
@@ -223,18 +427,93 @@ protected:
     int             m_nShutStatus;
 
     std::string     m_sRainStatusfilePath;
-    std::ofstream   m_RainStatusfile;
-    int             m_nRainStatus;
 
-    bool            m_bSaveRainStatus;
-    CStopWatch      m_cRainCheckTimer;
+    std::atomic<bool>       m_bSaveRainStatus;
+    CRainStatusFile         m_RainStatusFile;
+
+    CTelemetry              m_Telemetry;
+    std::atomic<bool>       m_bTelemetry;
+    CStopWatch              m_cTelemetryStatsTimer; // status poller thread only
+
+    CBatteryCache           m_BatteryCache;
+    long long               m_nBatteryRefreshTime;  // ns, last background read attempt, status poller thread only
+
+    // rain reaction. The watcher and the close and move tracking belong to the status poller thread.
+    std::atomic<int>        m_nRainAction;
+    std::atomic<bool>       m_bRainCloseShutter;
+    std::atomic<int>        m_nRainSampleInterval;
+    std::atomic<int>        m_nRainDebounce;
+    CRainWatcher            m_RainWatcher;
+    long long               m_nRainCloseSent;   // steady clock ns, 0 when no closing to confirm
+    long long               m_nRainCloseTried;  // steady clock ns, last closeshutter attempt
+    bool                    m_bRainMovePending; // the park or home hasn't gone through yet
+    long long               m_nRainMoveTried;   // steady clock ns, last park or home attempt
+
+    // status poller and its published snapshot (seqlock, even sequence = stable)
+    std::thread                 m_StatusPollerThread;
+    std::atomic<bool>           m_bPollerRunning;
+    std::atomic<int>            m_nPollInterval;
+    std::mutex                  m_PollerMutex;
+    std::condition_variable     m_PollerWakeup;
+    std::atomic<unsigned int>   m_nSnapshotSeq;
+    std::atomic<int>            m_nSnapshotStatus;
+    std::atomic<double>         m_dSnapshotAz;
+    std::atomic<long long>      m_nSnapshotTime;    // steady clock ns when the status request was sent
+    std::atomic<long long>      m_nStateChangeTime; // steady clock ns of the last command that changed the dome state
+
+    // response cache
+    struct CachedResponse {
+        std::string     sResp;
+        long long       nTime = 0;  // steady clock ns, 0 when stale
+        unsigned long   nHits = 0;
+        unsigned long   nMisses = 0;
+    };
+    std::map<std::string, CachedResponse>   m_CachedResponses;
+    std::mutex                  m_CacheMutex;
+    std::atomic<unsigned long>  m_nCacheHits;
+    std::atomic<unsigned long>  m_nCacheMisses;
+
+    // azimuth estimate between samples, fed by the poller and the commands that move the dome
+    std::mutex                  m_MotionMutex;
+    CDomeMotionModel            m_MotionModel;
+    // completion check schedule of the moves in progress
+    std::mutex                  m_ETAMutex;
+    CMoveETA                    m_MoveETA[MOVE_TYPES];
+
+    CGotoTolerance              m_GotoTolerance;
+    double                      m_dGotoDistance;    // degrees, of the current goto
+    double                      m_dGotoSpeed;       // degree/s, max rotation speed of the current goto
+    bool                        m_bGotoVia;         // going the long way, m_dGotoAz not sent yet
+    int                         m_nGotoDirection;
+    std::mutex                  m_DeadbandMutex;
+    CTrackingDeadband           m_TrackingDeadband;
+    bool                        m_bGotoAbsorbed;    // the last goto was within the deadband, nothing to wait for
+
+    LoggerInterface             *m_pLogger;
+    CClock                      *m_pClock;  // NULL : CClock::GetDefault()
+
+    // command latency statistics
+    std::mutex                  m_StatsMutex;
+    std::string                 m_sStatsVerb;
+    std::map<std::string, CLatencyHistogram>    m_DomeCmdLatency;
+    std::map<std::string, CLatencyHistogram>    m_ShutterCmdLatency;
+    CStopWatch                  m_cStatsLogTimer;
+    CLatencyHistogram           m_AbortLatency;
+    CLatencyHistogram           m_ShutterLinkLatency;   // all relayed messages
+    CShutterLink                m_ShutterLink;
+    std::atomic<long long>      m_nAbortRequestTime;    // steady clock ns
+    std::atomic<unsigned long>  m_nDroppedPolls;
+    std::atomic<unsigned long>  m_nMotionCmdCount;      // motion commands written
+    std::atomic<unsigned long>  m_nAbortedMotionCount;  // m_nMotionCmdCount when the last abort was written
     
-#ifdef PLUGIN_DEBUG
-    // timestamp for logs
-    const std::string getTimeStamp();
-    std::ofstream m_sLogFile;
+    // logs
+    bool isLogEnabled(int nLevel, int nCategory) { return (m_nLogFilter.load(std::memory_order_acquire) & LOG_FILTER_BIT(nLevel, nCategory)) != 0; }
+    const char *getTimeStamp();
+    CAsyncLogger m_sLogFile;
     std::string m_sLogfilePath;
-#endif
+    std::atomic<unsigned int>   m_nLogFilter;
+    int                         m_nLogLevel;
+    int                         m_nLogCategories;
 
 };
 
@@ -0,0 +1,128 @@
+//
+//  MoveETA.h
+//  LunaticoBeaver X2 plugin
+//
+//  Expected time of arrival of one kind of move (goto, shutter open, ...) and the
+//  schedule of its completion checks. The estimate is the predicted duration from
+//  distance and speeds, corrected by how long past moves actually took compared to
+//  their prediction, or just the average past duration when there is no prediction.
+//  Checks are sparse while the arrival is far away and dense around and after it.
+
+#ifndef __MoveETA__
+#define __MoveETA__
+
+#define ETA_MIN_CHECK_INTERVAL      50      // ms, around and after the expected arrival
+#define ETA_MAX_CHECK_INTERVAL      2000    // ms, early in a long move
+#define ETA_DEFAULT_CHECK_INTERVAL  250     // ms, nothing known about this kind of move yet
+#define ETA_HISTORY_WEIGHT          0.3     // weight of the last move in the running averages
+
+class CMoveETA
+{
+public:
+    CMoveETA() : m_dRatio(1.0), m_dAvgDuration(0), m_nMoves(0) { Stop(); }
+
+    // dPredicted in seconds, <= 0 if there is no model for this move
+    void Start(double dPredicted, long long nNow)
+    {
+        m_dPredicted = dPredicted;
+        if(dPredicted > 0)
+            m_dEstimate = dPredicted * m_dRatio;
+        else
+            m_dEstimate = m_nMoves ? m_dAvgDuration : -1;
+        m_nStart = nNow;
+        m_nNextCheck = nNow;
+        m_bActive = true;
+        ScheduleNextCheck(nNow);
+    }
+
+    // new remaining time from a measurement taken at nTime during the move. It replaces the
+    // estimate, the history is still learned against the prediction made at the start.
+    void Refine(double dRemaining, long long nTime)
+    {
+        if(!m_bActive || dRemaining < 0 || nTime < m_nStart)
+            return;
+        m_dEstimate = double(nTime - m_nStart) * 1e-9 + dRemaining;
+    }
+
+    // move done, learn from it
+    void Complete(long long nNow)
+    {
+        double dDuration;
+
+        if(!m_bActive)
+            return;
+        dDuration = double(nNow - m_nStart) * 1e-9;
+        if(m_dPredicted > 0 && dDuration > 0)
+            m_dRatio = blend(m_dRatio, clampRatio(dDuration / m_dPredicted));
+        m_dAvgDuration = m_nMoves ? blend(m_dAvgDuration, dDuration) : dDuration;
+        m_nMoves++;
+        Stop();
+    }
+
+    // aborted or failed, says nothing about how long a move takes
+    void Stop()
+    {
+        m_bActive = false;
+        m_dPredicted = -1;
+        m_dEstimate = -1;
+        m_nStart = 0;
+        m_nNextCheck = 0;
+    }
+
+    bool IsActive() const { return m_bActive; }
+
+    // true when the caller should really ask the controller
+    bool IsCheckDue(long long nNow) const { return !m_bActive || nNow >= m_nNextCheck; }
+
+    // the controller said we're not there yet
+    void ScheduleNextCheck(long long nNow)
+    {
+        long long nDelay;
+        double dRemaining = Remaining(nNow);
+
+        if(dRemaining < 0)
+            nDelay = ETA_DEFAULT_CHECK_INTERVAL;
+        else {
+            // half the remaining time, so the checks get closer as we get closer
+            nDelay = (long long)(dRemaining * 500.0);
+            if(nDelay < ETA_MIN_CHECK_INTERVAL)
+                nDelay = ETA_MIN_CHECK_INTERVAL;
+            if(nDelay > ETA_MAX_CHECK_INTERVAL)
+                nDelay = ETA_MAX_CHECK_INTERVAL;
+        }
+        m_nNextCheck = nNow + nDelay * 1000000LL;
+    }
+
+    // seconds to the expected arrival, 0 once it's overdue, -1 if not moving or unknown
+    double Remaining(long long nNow) const
+    {
+        double dRemaining;
+
+        if(!m_bActive || m_dEstimate < 0)
+            return -1;
+        dRemaining = m_dEstimate - double(nNow - m_nStart) * 1e-9;
+        return dRemaining > 0 ? dRemaining : 0;
+    }
+
+    double GetEstimate() const      { return m_dEstimate; }
+    double GetRatio() const         { return m_dRatio; }
+    double GetAvgDuration() const   { return m_dAvgDuration; }
+    unsigned long GetMoves() const  { return m_nMoves; }
+
+protected:
+    static double blend(double dAvg, double dValue) { return dAvg + ETA_HISTORY_WEIGHT * (dValue - dAvg); }
+    // a stall or a retry shouldn't wreck the model
+    static double clampRatio(double dRatio) { return dRatio < 0.2 ? 0.2 : (dRatio > 5.0 ? 5.0 : dRatio); }
+
+    double          m_dRatio;       // actual / predicted duration
+    double          m_dAvgDuration; // seconds
+    unsigned long   m_nMoves;
+
+    bool            m_bActive;
+    double          m_dPredicted;
+    double          m_dEstimate;
+    long long       m_nStart;       // ns
+    long long       m_nNextCheck;   // ns
+};
+
+#endif
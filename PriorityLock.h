@@ -0,0 +1,107 @@
+//
+//  PriorityLock.h
+//  LunaticoBeaver X2 plugin
+//
+//  Mutex granted by priority instead of arrival order. Level 0 is the most urgent.
+//  The holder is never preempted, but when it unlocks the most urgent waiter goes
+//  next, so an urgent request waits for at most the one command in flight.
+//  Droppable requests give up as soon as an urgent one is waiting or holds the lock.
+
+#ifndef __PriorityLock__
+#define __PriorityLock__
+
+#include <mutex>
+#include <condition_variable>
+
+#define PRIORITY_LOCK_LEVELS    4
+
+class CPriorityLock
+{
+public:
+    CPriorityLock() : m_bLocked(false), m_nHolder(-1)
+    {
+        for(int i = 0; i < PRIORITY_LOCK_LEVELS; i++)
+            m_nWaiting[i] = 0;
+    }
+
+    // false only for a droppable request that gave up
+    bool Lock(int nPriority, bool bDroppable = false)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+
+        if(bDroppable && isUrgentPending())
+            return false;
+
+        m_nWaiting[nPriority]++;
+        if(nPriority == 0)
+            m_Wakeup.notify_all();  // so the droppable waiters leave
+        m_Wakeup.wait(lock, [&]{ return (bDroppable && isUrgentPending()) || (!m_bLocked && !isWaitingAbove(nPriority)); });
+        m_nWaiting[nPriority]--;
+
+        if(bDroppable && isUrgentPending())
+            return false;
+
+        m_bLocked = true;
+        m_nHolder = nPriority;
+        return true;
+    }
+
+    void Unlock()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bLocked = false;
+        m_nHolder = -1;
+        m_Wakeup.notify_all();
+    }
+
+    bool IsUrgentPending()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return isUrgentPending();
+    }
+
+protected:
+    bool isUrgentPending() const { return m_nWaiting[0] > 0 || m_nHolder == 0; }
+
+    bool isWaitingAbove(int nPriority) const
+    {
+        for(int i = 0; i < nPriority; i++) {
+            if(m_nWaiting[i])
+                return true;
+        }
+        return false;
+    }
+
+    std::mutex              m_Mutex;
+    std::condition_variable m_Wakeup;
+    bool                    m_bLocked;
+    int                     m_nHolder;      // priority of the holder, -1 when free
+    int                     m_nWaiting[PRIORITY_LOCK_LEVELS];
+};
+
+// scoped lock, check IsLocked for droppable requests
+class CPriorityLocker
+{
+public:
+    CPriorityLocker(CPriorityLock &Lock, int nPriority, bool bDroppable = false) : m_Lock(Lock)
+    {
+        m_bLocked = m_Lock.Lock(nPriority, bDroppable);
+    }
+
+    ~CPriorityLocker()
+    {
+        if(m_bLocked)
+            m_Lock.Unlock();
+    }
+
+    bool IsLocked() const { return m_bLocked; }
+
+private:
+    CPriorityLocker(const CPriorityLocker &);
+    CPriorityLocker &operator=(const CPriorityLocker &);
+
+    CPriorityLock   &m_Lock;
+    bool            m_bLocked;
+};
+
+#endif
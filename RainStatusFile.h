@@ -0,0 +1,148 @@
+//
+//  RainStatusFile.h
+//  LunaticoBeaver X2 plugin
+//
+//  Publishes the rain state to a text file for external weather scripts.
+//  Publish only stores the state and wakes a background writer, so the caller
+//  never waits on the disk. The writer only touches the file when the state
+//  changes, writing a temporary file and renaming it over the old one, so a
+//  reader sees either the previous content or the new one, never a truncated file.
+
+#ifndef __RainStatusFile__
+#define __RainStatusFile__
+
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#if defined(SB_WIN_BUILD)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#define RAIN_FILE_UNKNOWN   -1  // nothing published yet, or a rewrite was asked for
+#define RAIN_FILE_INTERVAL  10000   // ms, status poll kept for the file when the poller is otherwise off
+
+class CRainStatusFile
+{
+public:
+    CRainStatusFile() : m_nState(RAIN_FILE_UNKNOWN), m_nWritten(RAIN_FILE_UNKNOWN), m_nWrites(0), m_nErrors(0), m_bRunning(false) { }
+    ~CRainStatusFile() { Stop(); }
+
+    void SetPath(const std::string &sPath)
+    {
+        std::lock_guard<std::mutex> lock(m_WriterMutex);
+        m_sPath = sPath;
+        m_sTmpPath = sPath + ".tmp";
+        m_nWritten = RAIN_FILE_UNKNOWN;
+    }
+
+    void Start()
+    {
+        if(m_bRunning)
+            return;
+        m_bRunning = true;
+        m_WriterThread = std::thread(&CRainStatusFile::writer, this);
+    }
+
+    // pending state changes are written before the writer exits
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_WriterMutex);
+            if(!m_bRunning)
+                return;
+            m_bRunning = false;
+        }
+        m_WriterWakeup.notify_all();
+        if(m_WriterThread.joinable())
+            m_WriterThread.join();
+    }
+
+    // bRaining from a decoded status, never blocks on the file
+    void Publish(bool bRaining)
+    {
+        int nState = bRaining ? 1 : 0;
+
+        if(m_nState.exchange(nState) == nState)
+            return;
+        m_WriterWakeup.notify_one();
+    }
+
+    // the next Publish rewrites the file even if the state didn't change
+    void Invalidate()
+    {
+        std::lock_guard<std::mutex> lock(m_WriterMutex);
+        m_nState = RAIN_FILE_UNKNOWN;
+        m_nWritten = RAIN_FILE_UNKNOWN;
+    }
+
+    unsigned long GetWrites() const { return m_nWrites; }
+    unsigned long GetErrors() const { return m_nErrors; }
+
+protected:
+    void writer()
+    {
+        int nState;
+        std::unique_lock<std::mutex> lock(m_WriterMutex);
+
+        while(true) {
+            nState = m_nState;
+            if(nState != RAIN_FILE_UNKNOWN && nState != m_nWritten && writeFile(nState)) {
+                m_nWritten = nState;
+                continue;   // the state may have changed again while writing
+            }
+            if(!m_bRunning)
+                break;
+            // the timeout retries a failed write and picks up a Publish whose notify came in while we were busy
+            m_WriterWakeup.wait_for(lock, std::chrono::milliseconds(1000));
+        }
+    }
+
+    // called by the writer thread with m_WriterMutex held
+    bool writeFile(int nState)
+    {
+        FILE *pFile;
+        bool bOk;
+
+        pFile = fopen(m_sTmpPath.c_str(), "w");
+        if(!pFile) {
+            m_nErrors++;
+            return false;
+        }
+        bOk = fprintf(pFile, "Raining:%s\n", nState ? "YES" : "NO") > 0;
+        bOk = (fclose(pFile) == 0) && bOk;
+#if defined(SB_WIN_BUILD)
+        bOk = bOk && MoveFileExA(m_sTmpPath.c_str(), m_sPath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        bOk = bOk && rename(m_sTmpPath.c_str(), m_sPath.c_str()) == 0;
+#endif
+        if(!bOk) {
+            remove(m_sTmpPath.c_str());
+            m_nErrors++;
+            return false;
+        }
+        m_nWrites++;
+        return true;
+    }
+
+    std::string                 m_sPath;
+    std::string                 m_sTmpPath;
+    std::atomic<int>            m_nState;   // last published, RAIN_FILE_UNKNOWN until the first one
+    int                         m_nWritten; // what the file says, under m_WriterMutex
+    std::atomic<unsigned long>  m_nWrites;
+    std::atomic<unsigned long>  m_nErrors;
+
+    std::thread                 m_WriterThread;
+    std::mutex                  m_WriterMutex;
+    std::condition_variable     m_WriterWakeup;
+    bool                        m_bRunning;
+};
+
+#endif
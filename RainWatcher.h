@@ -0,0 +1,63 @@
+//
+//  RainWatcher.h
+//  LunaticoBeaver X2 plugin
+//
+//  Debounces the rain bits of the dome status. A change only counts once every
+//  sample for the debounce time agrees with it, so a single glitch on the sensor
+//  line doesn't close the shutter. The onset is the first sample of the change,
+//  which is what the reaction latency is measured from.
+//  Not thread safe, only the status poller feeds it.
+
+#ifndef __RainWatcher__
+#define __RainWatcher__
+
+#define RAIN_SAMPLE_INTERVAL    250     // ms, status poll interval while a rain reaction is set
+#define RAIN_DEBOUNCE           500     // ms
+#define RAIN_RETRY_INTERVAL     5000    // ms, between two tries of a rain action that didn't go through
+
+enum RainEvents {RAIN_EVENT_NONE = 0, RAIN_EVENT_STARTED, RAIN_EVENT_STOPPED};
+
+class CRainWatcher
+{
+public:
+    CRainWatcher() : m_nDebounce(RAIN_DEBOUNCE * 1000000LL) { Reset(); }
+
+    void Reset()
+    {
+        m_bRaining = false;
+        m_nChangeStart = 0;
+        m_nOnset = 0;
+    }
+
+    void SetDebounce(int nMs) { m_nDebounce = nMs > 0 ? nMs * 1000000LL : 0; }
+
+    // nTime in ns, returns a RainEvents
+    int AddSample(bool bRain, long long nTime)
+    {
+        if(bRain == m_bRaining) {
+            m_nChangeStart = 0;
+            return RAIN_EVENT_NONE;
+        }
+        if(!m_nChangeStart)
+            m_nChangeStart = nTime;
+        if(nTime - m_nChangeStart < m_nDebounce)
+            return RAIN_EVENT_NONE;
+
+        m_bRaining = bRain;
+        m_nOnset = m_nChangeStart;
+        m_nChangeStart = 0;
+        return bRain ? RAIN_EVENT_STARTED : RAIN_EVENT_STOPPED;
+    }
+
+    bool IsRaining() const { return m_bRaining; }
+    // ns, first sample of the last confirmed change
+    long long GetOnset() const { return m_nOnset; }
+
+protected:
+    long long   m_nDebounce;    // ns
+    bool        m_bRaining;
+    long long   m_nChangeStart; // ns, first sample disagreeing with m_bRaining, 0 if none
+    long long   m_nOnset;
+};
+
+#endif
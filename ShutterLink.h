@@ -0,0 +1,152 @@
+//
+//  ShutterLink.h
+//  LunaticoBeaver X2 plugin
+//
+//  Schedules the messages relayed to the shutter ("!dome sendtoshutter ..."). They go
+//  over the radio to the battery powered shutter controller, and the open and close
+//  commands share that link.
+//  A token bucket holds the relay messages to a budget per minute. Commands that change
+//  something on the shutter always go, and use up the budget like the others. Queries
+//  over the budget are refused, the caller falls back on what it already knows.
+//  A query asked for while the same one is in flight waits for its answer instead of
+//  going out a second time.
+//  Thread safe.
+
+#ifndef __ShutterLink__
+#define __ShutterLink__
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#define SHUTTER_LINK_BUDGET     30      // relay messages per minute, 0 is unlimited
+
+struct ShutterLinkStats {
+    unsigned long   nSent;      // relay messages written
+    unsigned long   nRefused;   // queries over the budget
+    unsigned long   nMerged;    // queries answered by the same one already in flight
+    int             nBudget;    // per minute
+    double          dTokens;    // messages left in the budget
+};
+
+class CShutterLink
+{
+public:
+    CShutterLink() : m_nBudget(SHUTTER_LINK_BUDGET), m_dTokens(SHUTTER_LINK_BUDGET), m_nLastRefill(0) { ResetStats(); }
+
+    void SetBudget(int nPerMinute)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_nBudget = nPerMinute > 0 ? nPerMinute : 0;
+        m_dTokens = m_nBudget;
+        m_nLastRefill = 0;
+    }
+
+    // nMessages about to be relayed at nNow (ns), bChange if one of them isn't a query.
+    // False if they are queries and the budget can't take them.
+    bool Acquire(int nMessages, bool bChange, long long nNow)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        if(m_nBudget) {
+            refill(nNow);
+            if(!bChange && m_dTokens < nMessages) {
+                m_nRefused++;
+                return false;
+            }
+            m_dTokens = m_dTokens > nMessages ? m_dTokens - nMessages : 0;
+        }
+        m_nSent += nMessages;
+        return true;
+    }
+
+    // True if the caller sends sKey and then calls EndQuery. False if sKey was already
+    // in flight, sResp and nErr are then what the caller that sent it got.
+    bool BeginQuery(const std::string &sKey, std::string &sResp, int &nErr)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        std::map<std::string, std::shared_ptr<PendingQuery> >::iterator it;
+        std::shared_ptr<PendingQuery> pQuery;
+
+        it = m_InFlight.find(sKey);
+        if(it == m_InFlight.end()) {
+            m_InFlight[sKey] = std::make_shared<PendingQuery>();
+            return true;
+        }
+        pQuery = it->second;
+        m_nMerged++;
+        m_QueryDone.wait(lock, [&]{ return pQuery->bDone; });
+        sResp = pQuery->sResp;
+        nErr = pQuery->nErr;
+        return false;
+    }
+
+    void EndQuery(const std::string &sKey, const std::string &sResp, int nErr)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::map<std::string, std::shared_ptr<PendingQuery> >::iterator it;
+
+        it = m_InFlight.find(sKey);
+        if(it == m_InFlight.end())
+            return;
+        it->second->sResp = sResp;
+        it->second->nErr = nErr;
+        it->second->bDone = true;
+        m_InFlight.erase(it);
+        m_QueryDone.notify_all();
+    }
+
+    void GetStats(ShutterLinkStats &Stats, long long nNow)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_nBudget)
+            refill(nNow);
+        Stats.nSent = m_nSent;
+        Stats.nRefused = m_nRefused;
+        Stats.nMerged = m_nMerged;
+        Stats.nBudget = m_nBudget;
+        Stats.dTokens = m_dTokens;
+    }
+
+    void ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_nSent = 0;
+        m_nRefused = 0;
+        m_nMerged = 0;
+    }
+
+protected:
+    struct PendingQuery {
+        PendingQuery() : bDone(false), nErr(0) { }
+        bool        bDone;
+        std::string sResp;
+        int         nErr;
+    };
+
+    // called with m_Mutex held, the bucket holds at most a minute of budget
+    void refill(long long nNow)
+    {
+        if(m_nLastRefill && nNow > m_nLastRefill) {
+            m_dTokens += double(nNow - m_nLastRefill) * m_nBudget / 60e9;
+            if(m_dTokens > m_nBudget)
+                m_dTokens = m_nBudget;
+        }
+        m_nLastRefill = nNow;
+    }
+
+    std::mutex              m_Mutex;
+    std::condition_variable m_QueryDone;
+    int                     m_nBudget;
+    double                  m_dTokens;
+    long long               m_nLastRefill;  // ns, 0 until the first message
+    std::map<std::string, std::shared_ptr<PendingQuery> >  m_InFlight;
+
+    unsigned long           m_nSent;
+    unsigned long           m_nRefused;
+    unsigned long           m_nMerged;
+};
+
+#endif
@@ -0,0 +1,109 @@
+//
+//  SlewPlanner.h
+//  LunaticoBeaver X2 plugin
+//
+//  Picks the fastest way to a new azimuth with the rotation profile of the motion model.
+//  From rest that's the shortest way, but when the dome is already moving it can be faster
+//  to carry on the long way round than to brake, reverse and accelerate again. The controller
+//  always takes the shortest way to a gotoaz target, so the long way is done through a via
+//  point and the real target is sent once it's less than half a turn ahead.
+//  A new target close enough to the one the dome is already going to is merged with it.
+
+#ifndef __SlewPlanner__
+#define __SlewPlanner__
+
+#include "DomeMotionModel.h"
+
+#define SLEW_VIA_MIN_GAIN   1.0     // seconds, the long way has to be at least this much faster
+#define SLEW_VIA_MARGIN     10.0    // degrees, the target has to be this far inside half a turn before it's sent
+
+struct SlewPlan {
+    double  dTargetAz;
+    int     nDirection;     // 1 : increasing azimuth, -1 : decreasing
+    double  dDistance;      // degrees along nDirection
+    double  dTime;          // seconds, -1 without a rotation profile
+    bool    bMerge;         // the pending goto gets close enough, nothing to send
+    bool    bVia;           // go to dViaAz first, see above
+    double  dViaAz;
+};
+
+class CSlewPlanner
+{
+public:
+    // dFromAz is where the dome is now, Model its motion. bPending says if a goto to
+    // dPendingAz is still in progress.
+    static void Plan(const CDomeMotionModel &Model, double dFromAz, double dTargetAz, bool bPending, double dPendingAz, double dMergeTolerance, SlewPlan &Plan)
+    {
+        double dShort;
+        int nShortDirection;
+        double dShortTime;
+        double dLongTime;
+
+        Plan.dTargetAz = CDomeMotionModel::Normalize(dTargetAz);
+        Plan.bMerge = false;
+        Plan.bVia = false;
+        Plan.dViaAz = Plan.dTargetAz;
+
+        dShort = CDomeMotionModel::AngleDiff(dFromAz, Plan.dTargetAz);
+        nShortDirection = dShort < 0 ? -1 : 1;
+        dShort = fabs(dShort);
+
+        Plan.nDirection = nShortDirection;
+        Plan.dDistance = dShort;
+        Plan.dTime = -1;
+
+        if(bPending && fabs(CDomeMotionModel::AngleDiff(dPendingAz, Plan.dTargetAz)) <= dMergeTolerance) {
+            Plan.bMerge = true;
+            return;
+        }
+
+        dShortTime = RouteTime(Model, nShortDirection, dShort);
+        dLongTime = RouteTime(Model, -nShortDirection, 360.0 - dShort);
+        Plan.dTime = dShortTime;
+        if(dShortTime < 0 || dLongTime < 0 || dLongTime + SLEW_VIA_MIN_GAIN >= dShortTime)
+            return;
+
+        // the long way round, through a point the controller will reach going that way
+        Plan.nDirection = -nShortDirection;
+        Plan.dDistance = 360.0 - dShort;
+        Plan.dTime = dLongTime;
+        Plan.bVia = true;
+        Plan.dViaAz = CDomeMotionModel::Normalize(dFromAz + Plan.nDirection * Plan.dDistance / 2.0);
+    }
+
+    // true once the target is close enough ahead that the controller's shortest way is nDirection
+    static bool IsTargetAhead(double dFromAz, double dTargetAz, int nDirection)
+    {
+        double dAhead = CDomeMotionModel::AngleDiff(dFromAz, dTargetAz) * nDirection;
+        return dAhead >= 0 && dAhead < 180.0 - SLEW_VIA_MARGIN;
+    }
+
+    // seconds to travel dDistance degrees in nDirection from the model's current motion
+    static double RouteTime(const CDomeMotionModel &Model, int nDirection, double dDistance)
+    {
+        double dSpeed = Model.GetVelocity() * nDirection;
+        double dBraking;
+        double dStopTime;
+        double dTime;
+
+        if(!Model.HasProfile())
+            return -1;
+
+        dBraking = Model.BrakingDistance(fabs(dSpeed));
+        dStopTime = Model.GetAccel() > 0 ? fabs(dSpeed) / Model.GetAccel() : 0;
+
+        if(dSpeed >= 0) {
+            if(dDistance >= dBraking)
+                return Model.MoveTime(dDistance, dSpeed);
+            // too close to stop in time, overshoot and come back
+            dTime = Model.MoveTime(dBraking - dDistance, 0);
+            return dTime < 0 ? -1 : dStopTime + dTime;
+        }
+
+        // moving the other way, stop first
+        dTime = Model.MoveTime(dDistance + dBraking, 0);
+        return dTime < 0 ? -1 : dStopTime + dTime;
+    }
+};
+
+#endif
@@ -3,9 +3,11 @@
 // Code by Richard S. Wright Jr.
 // March 23, 1999
 // 
-// This function uses the High performance counter on Win32 and
-// gettimeofday on Mac OS X/Linux. gettimeofday is actually pretty
-// good on the Mac (about 10ms).
+// Originally used the High performance counter on Win32 and
+// gettimeofday on Mac OS X/Linux. Now reads an injectable monotonic
+// clock (std::chrono::steady_clock by default) in nanoseconds, so
+// timers don't jump when NTP steps the wall clock and tests can run
+// on virtual time.
 
 /* Copyright (c) 2005-2009, Richard S. Wright Jr.
 All rights reserved.
@@ -38,11 +40,65 @@ ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF S
 #ifndef STOPWATCH_HEADER
 #define STOPWATCH_HEADER
 
-#ifdef WIN32
-#include <windows.h>
-#else
-#include <sys/time.h>
-#endif
+#include <atomic>
+#include <chrono>
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Time source for the stopwatches, monotonic nanoseconds from an arbitrary origin.
+class CClock
+	{
+	public:
+		virtual ~CClock(void) { }
+		virtual long long Now(void) = 0;
+
+		// clock used by stopwatches that weren't given one
+		static CClock *GetDefault(void);
+		// NULL restores the steady clock. Stopwatches read the default on every call,
+		// so this also affects the ones that already exist.
+		static void SetDefault(CClock *pClock) { DefaultClock().store(pClock); }
+
+	protected:
+		static std::atomic<CClock *> &DefaultClock(void)
+			{
+			static std::atomic<CClock *> pDefault(NULL);
+			return pDefault;
+			}
+	};
+
+class CSteadyClock : public CClock
+	{
+	public:
+		virtual long long Now(void)
+			{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			}
+	};
+
+// Clock that only moves when told to, for tests and the emulator.
+class CVirtualClock : public CClock
+	{
+	public:
+		// starts at 1s, a time of 0 often means "never" to the callers
+		explicit CVirtualClock(long long nStartNs = 1000000000LL) : m_nNow(nStartNs) { }
+
+		virtual long long Now(void) { return m_nNow.load(); }
+
+		void Set(long long nNs)                 { m_nNow.store(nNs); }
+		void Advance(long long nNs)             { m_nNow.fetch_add(nNs); }
+		void AdvanceMilliseconds(long long nMs) { m_nNow.fetch_add(nMs * 1000000LL); }
+
+	protected:
+		std::atomic<long long> m_nNow;
+	};
+
+inline CClock *CClock::GetDefault(void)
+	{
+	static CSteadyClock SteadyClock;
+	CClock *pClock = DefaultClock().load();
+
+	return pClock ? pClock : &SteadyClock;
+	}
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -53,53 +109,82 @@ ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF S
 class CStopWatch
 	{
 	public:
-		CStopWatch(void)	// Constructor
+		explicit CStopWatch(CClock *pClock = NULL)	// Constructor, NULL uses the default clock
+			: m_pClock(pClock)
 			{
-			#ifdef WIN32
-			QueryPerformanceFrequency(&m_CounterFrequency);
-			QueryPerformanceCounter(&m_LastCount);
-			#else
-            gettimeofday(&m_LastCount, 0);
-			#endif
+			Reset();
+			}
+
+		// switch clock, restarts the timer
+		void SetClock(CClock *pClock)
+			{
+			m_pClock = pClock;
+			Reset();
 			}
 
 		// Resets timer (difference) to zero
 		inline void Reset(void) 
 			{
-			#ifdef WIN32
-			QueryPerformanceCounter(&m_LastCount);
-			#else
-			gettimeofday(&m_LastCount, 0);
-			#endif
+			m_nLastCount = GetClock()->Now();
 			}					
 		
+		long long GetElapsedNanoseconds(void)	{ return GetClock()->Now() - m_nLastCount; }
+		long long GetElapsedMicroseconds(void)	{ return GetElapsedNanoseconds() / 1000; }
+		long long GetElapsedMilliseconds(void)	{ return GetElapsedNanoseconds() / 1000000; }
+
 		// Get elapsed time in seconds
-		float GetElapsedSeconds(void)
+		double GetElapsedSeconds(void)
 			{
-			// Get the current count
-			#ifdef WIN32
-			LARGE_INTEGER lCurrent;
-			QueryPerformanceCounter(&lCurrent);
-
-			return float((lCurrent.QuadPart - m_LastCount.QuadPart) /
-										double(m_CounterFrequency.QuadPart));
-			#else
-            timeval lcurrent;
-            gettimeofday(&lcurrent, 0);
-            float fSeconds = (float)(lcurrent.tv_sec - m_LastCount.tv_sec);
-            float fFraction = (float)(lcurrent.tv_usec - m_LastCount.tv_usec) * 0.000001f;
-            return fSeconds + fFraction;
-			#endif
+			return double(GetElapsedNanoseconds()) * 1e-9;
 			}	
 	
 	protected:
-	#ifdef WIN32
-		LARGE_INTEGER m_CounterFrequency;
-		LARGE_INTEGER m_LastCount;
-	#else
-        timeval m_LastCount;
-	#endif
+		CClock *GetClock(void) { return m_pClock ? m_pClock : CClock::GetDefault(); }
+
+		CClock		*m_pClock;
+		long long	m_nLastCount;	// ns
+	};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Calls fOnStop(elapsed ns) when it goes out of scope, on every return path.
+//     auto Timer = MakeScopedTimer([&](long long nNs) { ... });
+template <typename F>
+class CScopedTimer
+	{
+	public:
+		explicit CScopedTimer(F fOnStop, CClock *pClock = NULL) : m_fOnStop(fOnStop), m_StopWatch(pClock), m_bArmed(true) { }
+
+		CScopedTimer(CScopedTimer &&Other) : m_fOnStop(Other.m_fOnStop), m_StopWatch(Other.m_StopWatch), m_bArmed(Other.m_bArmed)
+			{
+			Other.m_bArmed = false;
+			}
+
+		~CScopedTimer(void)
+			{
+			if(m_bArmed)
+				m_fOnStop(m_StopWatch.GetElapsedNanoseconds());
+			}
+
+		// don't report anything
+		void Cancel(void) { m_bArmed = false; }
+
+		long long GetElapsedNanoseconds(void) { return m_StopWatch.GetElapsedNanoseconds(); }
+
+	private:
+		CScopedTimer(const CScopedTimer &);
+		CScopedTimer &operator=(const CScopedTimer &);
+
+		F			m_fOnStop;
+		CStopWatch	m_StopWatch;
+		bool		m_bArmed;
 	};
 
+template <typename F>
+inline CScopedTimer<F> MakeScopedTimer(F fOnStop, CClock *pClock = NULL)
+	{
+	return CScopedTimer<F>(fOnStop, pClock);
+	}
+
 
 #endif
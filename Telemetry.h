@@ -0,0 +1,274 @@
+//
+//  Telemetry.h
+//  LunaticoBeaver X2 plugin
+//
+//  Read only view of the driver for local tools, in a shared memory segment
+//  ("/LunaticoBeaver" with shm_open, "Local\LunaticoBeaver" on Windows).
+//  The layout is fixed : only add fields at the end and bump TELEMETRY_VERSION.
+//  Updates go through a seqlock, readers never block the driver and never talk
+//  to the controller, so they can poll as often as they like :
+//
+//      BeaverTelemetry Copy;
+//      while(!CTelemetry::Read(pShared, Copy))
+//          ;   // caught in the middle of an update, try again
+//
+//  The writer side is thread safe, the status poller and the commands both update it.
+//  A segment still held by another running driver is left alone, one left behind by
+//  a crash is replaced.
+
+#ifndef __Telemetry__
+#define __Telemetry__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+
+#if defined(SB_WIN_BUILD)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define TELEMETRY_NAME          "Local\\LunaticoBeaver"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#define TELEMETRY_NAME          "/LunaticoBeaver"
+#endif
+
+#define TELEMETRY_MAGIC         0x4D54424C  // "LBTM"
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_MAX_VERBS     16
+#define TELEMETRY_VERB_SIZE     48
+#define TELEMETRY_STATS_INTERVAL 1000       // ms between command latency updates
+
+// latency of one command verb, times in microseconds
+struct TelemetryLatency {
+    char        szVerb[TELEMETRY_VERB_SIZE];    // shutter commands are prefixed with "(shutter) "
+    uint32_t    nCount;
+    uint32_t    nTimeouts;
+    uint32_t    nErrors;
+    uint32_t    nP50Us;
+    uint32_t    nP99Us;
+    uint32_t    nMaxUs;
+};
+
+struct BeaverTelemetry {
+    uint32_t                nMagic;
+    uint16_t                nVersion;
+    uint16_t                nSize;          // sizeof(BeaverTelemetry) of the writer
+    std::atomic<uint32_t>   nSeq;           // odd while an update is in progress
+    uint32_t                nPid;           // of the process running the driver
+
+    int64_t                 nUpdateTime;    // us since the epoch, last update
+    uint64_t                nUpdates;
+
+    int32_t                 bConnected;
+    int32_t                 nStatus;        // raw "!dome status#" bits, see DOME_MOVING ...
+    int32_t                 nShutterState;  // DomeShutterState
+    int32_t                 nRain;          // RainSensorStates
+    double                  dAz;            // degrees
+    double                  dTargetAz;      // degrees, valid while bHasTarget
+    int32_t                 bHasTarget;
+    int32_t                 nPad;
+    int64_t                 nStatusTime;    // us since the epoch, last status sample
+
+    double                  dShutterVolts;
+    double                  dShutterCutOff;
+    int64_t                 nBatteryTime;   // us since the epoch, 0 if never read
+
+    uint32_t                nVerbs;
+    uint32_t                nAbortP99Us;    // abort request to abort written
+    TelemetryLatency        Latency[TELEMETRY_MAX_VERBS];
+};
+
+class CTelemetry
+{
+public:
+    CTelemetry() : m_pShared(NULL)
+    {
+#if defined(SB_WIN_BUILD)
+        m_hMapping = NULL;
+#endif
+    }
+    ~CTelemetry() { Close(); }
+
+    bool Open()
+    {
+        std::lock_guard<std::mutex> lock(m_WriteMutex);
+        void *pMem;
+
+        if(m_pShared)
+            return true;
+#if defined(SB_WIN_BUILD)
+        bool bExisted;
+
+        // the mapping goes away with its last handle, one that already exists is either
+        // another driver's or kept alive by a reader after a crash
+        m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(BeaverTelemetry), TELEMETRY_NAME);
+        if(!m_hMapping)
+            return false;
+        bExisted = (GetLastError() == ERROR_ALREADY_EXISTS);
+        pMem = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(BeaverTelemetry));
+        if(!pMem || (bExisted && isOwnerRunning((BeaverTelemetry *)pMem))) {
+            if(pMem)
+                UnmapViewOfFile(pMem);
+            CloseHandle(m_hMapping);
+            m_hMapping = NULL;
+            return false;
+        }
+#else
+        int nFd;
+
+        // always a new segment : macOS only sets the size of a segment once
+        nFd = shm_open(TELEMETRY_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(nFd < 0 && errno == EEXIST) {
+            if(isOwnerRunning())
+                return false;
+            // left behind by a crash
+            shm_unlink(TELEMETRY_NAME);
+            nFd = shm_open(TELEMETRY_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if(nFd < 0)
+            return false;
+        if(ftruncate(nFd, sizeof(BeaverTelemetry)) != 0) {
+            close(nFd);
+            shm_unlink(TELEMETRY_NAME);
+            return false;
+        }
+        pMem = mmap(NULL, sizeof(BeaverTelemetry), PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0);
+        close(nFd);
+        if(pMem == MAP_FAILED) {
+            shm_unlink(TELEMETRY_NAME);
+            return false;
+        }
+#endif
+        // header last, so a reader that sees the magic sees a zeroed record
+        m_pShared = (BeaverTelemetry *)pMem;
+        memset((char *)m_pShared + offsetof(BeaverTelemetry, nUpdateTime), 0, sizeof(BeaverTelemetry) - offsetof(BeaverTelemetry, nUpdateTime));
+        m_pShared->nSeq.store(0, std::memory_order_relaxed);
+#if defined(SB_WIN_BUILD)
+        m_pShared->nPid = (uint32_t)GetCurrentProcessId();
+#else
+        m_pShared->nPid = (uint32_t)getpid();
+#endif
+        m_pShared->nSize = sizeof(BeaverTelemetry);
+        m_pShared->nVersion = TELEMETRY_VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        m_pShared->nMagic = TELEMETRY_MAGIC;
+        return true;
+    }
+
+    // the segment goes away with its last reader
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(m_WriteMutex);
+
+        if(!m_pShared)
+            return;
+        m_pShared->bConnected = 0;
+#if defined(SB_WIN_BUILD)
+        UnmapViewOfFile(m_pShared);
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+#else
+        munmap(m_pShared, sizeof(BeaverTelemetry));
+        shm_unlink(TELEMETRY_NAME);
+#endif
+        m_pShared = NULL;
+    }
+
+    bool IsOpen() const { return m_pShared != NULL; }
+
+    // NULL if the segment isn't open. Otherwise fill in the fields and call EndUpdate,
+    // other writers wait in between.
+    BeaverTelemetry *BeginUpdate()
+    {
+        m_WriteMutex.lock();
+        if(!m_pShared) {
+            m_WriteMutex.unlock();
+            return NULL;
+        }
+        m_pShared->nSeq.fetch_add(1, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_release);
+        return m_pShared;
+    }
+
+    void EndUpdate(int64_t nNow)
+    {
+        m_pShared->nUpdateTime = nNow;
+        m_pShared->nUpdates++;
+        m_pShared->nSeq.fetch_add(1, std::memory_order_release);
+        m_WriteMutex.unlock();
+    }
+
+    // consistent copy of a segment mapped by a reader, false if it was being updated
+    static bool Read(const BeaverTelemetry *pShared, BeaverTelemetry &Copy)
+    {
+        uint32_t nSeq;
+
+        nSeq = pShared->nSeq.load(std::memory_order_acquire);
+        if(nSeq & 1)
+            return false;
+        memcpy((void *)&Copy, (const void *)pShared, sizeof(BeaverTelemetry));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return pShared->nSeq.load(std::memory_order_relaxed) == nSeq;
+    }
+
+protected:
+#if defined(SB_WIN_BUILD)
+    // pExisting is the mapping that was already there
+    static bool isOwnerRunning(const BeaverTelemetry *pExisting)
+    {
+        HANDLE hProcess;
+        bool bRunning;
+
+        if(pExisting->nMagic != TELEMETRY_MAGIC || !pExisting->nPid)
+            return false;
+        hProcess = OpenProcess(SYNCHRONIZE, FALSE, pExisting->nPid);
+        if(!hProcess)
+            return false;
+        bRunning = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+        CloseHandle(hProcess);
+        return bRunning;
+    }
+#else
+    // true if the segment already under TELEMETRY_NAME belongs to a driver that is still running
+    static bool isOwnerRunning()
+    {
+        int nFd;
+        struct stat Stat;
+        void *pMem;
+        const BeaverTelemetry *pExisting;
+        bool bRunning = false;
+
+        nFd = shm_open(TELEMETRY_NAME, O_RDONLY, 0);
+        if(nFd < 0)
+            return false;
+        if(fstat(nFd, &Stat) == 0 && Stat.st_size >= (off_t)sizeof(BeaverTelemetry)) {
+            pMem = mmap(NULL, sizeof(BeaverTelemetry), PROT_READ, MAP_SHARED, nFd, 0);
+            if(pMem != MAP_FAILED) {
+                pExisting = (const BeaverTelemetry *)pMem;
+                if(pExisting->nMagic == TELEMETRY_MAGIC && pExisting->nPid)
+                    bRunning = (kill((pid_t)pExisting->nPid, 0) == 0 || errno == EPERM);
+                munmap(pMem, sizeof(BeaverTelemetry));
+            }
+        }
+        close(nFd);
+        return bRunning;
+    }
+#endif
+
+    BeaverTelemetry     *m_pShared;
+    std::mutex          m_WriteMutex;
+#if defined(SB_WIN_BUILD)
+    HANDLE              m_hMapping;
+#endif
+};
+
+#endif
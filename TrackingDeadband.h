@@ -0,0 +1,116 @@
+//
+//  TrackingDeadband.h
+//  LunaticoBeaver X2 plugin
+//
+//  Filters the small gotos TheSkyX sends every few seconds while the dome is slaved.
+//  As long as the telescope stays within the deadband of where the dome is (or is going)
+//  it still looks through the slit, so nothing is sent. Once it leaves the deadband the
+//  dome is sent past the requested azimuth by the lead in the tracking direction, so the
+//  telescope crosses the slit center and the next move comes twice as late.
+//  Requests further away than a slit width are slews and are always sent as they are.
+//  Disabled until the slit width is known. Not thread safe, the caller locks.
+
+#ifndef __TrackingDeadband__
+#define __TrackingDeadband__
+
+#include "DomeMotionModel.h"
+
+#define DEADBAND_DEFAULT_PERCENT    25      // of the slit width
+#define DEADBAND_LEAD_PERCENT       100     // of the deadband
+
+class CTrackingDeadband
+{
+public:
+    CTrackingDeadband() : m_dSlitWidth(0), m_dDeadband(0), m_dLead(0) { Reset(); ResetStats(); }
+
+    // forget the tracking direction, after a slew, an abort or a sync
+    void Reset()
+    {
+        m_bHasLastRequest = false;
+        m_dLastRequestAz = 0;
+    }
+
+    // dSlitWidth in degrees, 0 disables the filter. nDeadband in percent of the slit width,
+    // nLead in percent of the deadband.
+    void Configure(double dSlitWidth, int nDeadband, int nLead)
+    {
+        m_dSlitWidth = dSlitWidth > 0 ? dSlitWidth : 0;
+        if(nDeadband < 0)
+            nDeadband = 0;
+        if(nDeadband > 50)
+            nDeadband = 50;     // past half the slit width the telescope sees the shutter
+        if(nLead < 0)
+            nLead = 0;
+        if(nLead > 100)
+            nLead = 100;
+        m_dDeadband = m_dSlitWidth * nDeadband / 100.0;
+        m_dLead = m_dDeadband * nLead / 100.0;
+    }
+
+    bool IsEnabled() const { return m_dDeadband > 0; }
+    double GetSlitWidth() const { return m_dSlitWidth; }
+    double GetDeadband() const { return m_dDeadband; }
+    double GetLead() const { return m_dLead; }
+
+    // dDomeAz is where the dome is, or where it's going if it's moving. Returns false when the
+    // request is absorbed, otherwise dGotoAz is where to send the dome.
+    bool Filter(double dDomeAz, double dRequestedAz, double &dGotoAz)
+    {
+        double dError;
+        double dStep;
+        int nTrend = 0;
+
+        dRequestedAz = CDomeMotionModel::Normalize(dRequestedAz);
+        dGotoAz = dRequestedAz;
+
+        if(m_bHasLastRequest) {
+            dStep = CDomeMotionModel::AngleDiff(m_dLastRequestAz, dRequestedAz);
+            if(dStep != 0 && fabs(dStep) <= m_dSlitWidth)
+                nTrend = dStep < 0 ? -1 : 1;
+        }
+        m_dLastRequestAz = dRequestedAz;
+        m_bHasLastRequest = true;
+
+        if(!IsEnabled()) {
+            m_nIssued++;
+            return true;
+        }
+
+        dError = CDomeMotionModel::AngleDiff(dDomeAz, dRequestedAz);
+        if(fabs(dError) <= m_dDeadband) {
+            m_nSuppressed++;
+            return false;
+        }
+
+        // only lead a tracking step in the direction the telescope has been going
+        if(fabs(dError) <= m_dSlitWidth && nTrend == (dError < 0 ? -1 : 1))
+            dGotoAz = CDomeMotionModel::Normalize(dRequestedAz + nTrend * m_dLead);
+        m_nIssued++;
+        return true;
+    }
+
+    void GetStats(unsigned long &nIssued, unsigned long &nSuppressed) const
+    {
+        nIssued = m_nIssued;
+        nSuppressed = m_nSuppressed;
+    }
+
+    void ResetStats()
+    {
+        m_nIssued = 0;
+        m_nSuppressed = 0;
+    }
+
+protected:
+    double          m_dSlitWidth;
+    double          m_dDeadband;
+    double          m_dLead;
+
+    bool            m_bHasLastRequest;
+    double          m_dLastRequestAz;
+
+    unsigned long   m_nIssued;
+    unsigned long   m_nSuppressed;
+};
+
+#endif
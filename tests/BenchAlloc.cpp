@@ -0,0 +1,141 @@
+//
+//  BenchAlloc.cpp
+//  LunaticoBeaver X2 plugin tests
+//
+//  Heap allocations and time per call of the response parser, against what
+//  parseFields did before it : trim, split through a stringstream into a vector
+//  of strings, then std::stod / std::stoi. Its own program as it replaces the
+//  global operator new to count the allocations.
+
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+#include "TestBeaver.h"
+#include "BenchSamples.h"
+
+#define ALLOC_BENCH_ROUNDS  100000
+
+static std::atomic<long long> nAllocations(0);
+
+void *operator new(size_t nSize)
+{
+    void *p;
+
+    nAllocations++;
+    p = malloc(nSize ? nSize : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+#pragma mark - parseFields, as it was
+
+static std::string &trimFields(std::string &str, const std::string &filter)
+{
+    str.erase(str.find_last_not_of(filter) + 1);
+    str.erase(0, str.find_first_not_of(filter));
+    return str;
+}
+
+static int parseFields(std::string sResp, std::vector<std::string> &svFields, char cSeparator)
+{
+    std::string sSegment;
+
+    sResp = trimFields(sResp, "!#\r\n");
+    if(!sResp.size())
+        return ERR_CMDFAILED;
+
+    std::stringstream ssTmp(sResp);
+
+    svFields.clear();
+    while(std::getline(ssTmp, sSegment, cSeparator))
+        svFields.push_back(sSegment);
+
+    return svFields.size() ? PLUGIN_OK : ERR_CMDFAILED;
+}
+
+static int parseFieldsValue(const std::string &sResp, double &dValue)
+{
+    std::vector<std::string> svFields;
+
+    parseFields(sResp, svFields, ':');
+    if(svFields.size() < 2)
+        return ERR_CMDFAILED;
+    try {
+        dValue = std::stod(svFields[1]);
+    } catch(const std::exception &e) {
+        return ERR_CMDFAILED;
+    }
+    return PLUGIN_OK;
+}
+
+static int parseFieldsValue(const std::string &sResp, int &nValue)
+{
+    std::vector<std::string> svFields;
+
+    parseFields(sResp, svFields, ':');
+    if(svFields.size() < 2)
+        return ERR_CMDFAILED;
+    try {
+        nValue = std::stoi(svFields[1]);
+    } catch(const std::exception &e) {
+        return ERR_CMDFAILED;
+    }
+    return PLUGIN_OK;
+}
+
+#pragma mark - benchmark
+
+// allocations and ns per call of Parse, once the responses are in hand like they are after readResponse
+template <typename Parser> static void benchParser(const char *pszName, Parser Parse)
+{
+    CBenchSamples Time;
+    BenchClock::time_point tStart;
+    long long nStartAllocations;
+
+    // counted apart from the timing, the samples allocate as they grow
+    nStartAllocations = nAllocations;
+    for(int i = 0; i < ALLOC_BENCH_ROUNDS; i++)
+        Parse();
+    printf("  %-40s %5.2f allocations per call\n", pszName, double(nAllocations - nStartAllocations) / ALLOC_BENCH_ROUNDS);
+
+    for(int i = 0; i < ALLOC_BENCH_ROUNDS; i++) {
+        tStart = BenchClock::now();
+        Parse();
+        Time.Add(elapsedNs(tStart));
+    }
+    Time.Print("", "ns");
+}
+
+int main()
+{
+    CTestBeaver Beaver;
+    const std::string sAz("!dome getaz:123.45");
+    const std::string sStatus("!dome status:4352");
+    const std::string sVersion("!seletek version:2510");
+    double dValue;
+    int nValue;
+
+    printf("response parsing\n");
+    benchParser("parseFields + stod, getaz", [&]() { parseFieldsValue(sAz, dValue); });
+    benchParser("parseValue(double), getaz", [&]() { Beaver.parseValue(sAz, dValue); });
+    benchParser("parseFields + stoi, status", [&]() { parseFieldsValue(sStatus, nValue); });
+    benchParser("parseValue(int), status", [&]() { Beaver.parseValue(sStatus, nValue); });
+    benchParser("getResponseField, version", [&]() {
+        const char *pszField;
+        size_t nFieldLen;
+        Beaver.getResponseField(sVersion, pszField, nFieldLen);
+    });
+    return 0;
+}
@@ -0,0 +1,178 @@
+//
+//  BenchBeaver.cpp
+//  LunaticoBeaver X2 plugin tests
+//
+//  Latency benchmarks of CLunaticoBeaver against the scripted serial port.
+//  "make bench", prints the percentiles in us. The link runs at 115200 with a
+//  controller taking BENCH_CONTROLLER_DELAY to answer, so the numbers are the
+//  driver's overhead on top of what the wire costs.
+
+#include "TestBeaver.h"
+#include "BenchSamples.h"
+#include "x2dome.h"
+
+#define BENCH_CONTROLLER_DELAY  2000    // us
+#define BENCH_ROUNDS            500
+#define BENCH_RELAY_DELAY       50000   // us, the radio link to the shutter
+#define STRESS_DURATION         3000    // ms per phase
+#define STRESS_SAMPLE_INTERVAL  2       // ms between two dapiGetAzEl
+
+#pragma mark - round trips
+
+// one command per round trip, and the status pair batched as the poller sends it
+static void benchRoundTrips()
+{
+    CFakeSerX Serx;
+    CTestBeaver Beaver;
+    CBenchSamples Status, Az, Pair;
+    std::string sResp;
+    std::vector<std::string> svResps;
+    BenchClock::time_point tStart;
+
+    printf("round trips at 115200, controller answering in %d us\n", BENCH_CONTROLLER_DELAY);
+    connectBeaver(Beaver, Serx, FAKE_BYTE_LATENCY_115200, BENCH_CONTROLLER_DELAY);
+
+    for(int i = 0; i < BENCH_ROUNDS; i++) {
+        Beaver.clearResponseCache();
+        tStart = BenchClock::now();
+        Beaver.domeCommand("!dome status#", sResp);
+        Status.Add(elapsedUs(tStart));
+
+        Beaver.clearResponseCache();
+        tStart = BenchClock::now();
+        Beaver.domeCommand("!dome getaz#", sResp);
+        Az.Add(elapsedUs(tStart));
+
+        tStart = BenchClock::now();
+        Beaver.domeCommandBatch({"!dome status#", "!dome getaz#"}, svResps, MAX_TIMEOUT, false);
+        Pair.Add(elapsedUs(tStart));
+    }
+    Status.Print("domeCommand !dome status#");
+    Az.Print("domeCommand !dome getaz#");
+    Pair.Print("domeCommandBatch status + getaz");
+    Beaver.Disconnect();
+}
+
+#pragma mark - dapiGetAzEl under load
+
+// TheSkyX's per-driver mutex
+class CBenchMutex : public MutexInterface
+{
+public:
+    void lock()     { m_Mutex.lock(); }
+    void unlock()   { m_Mutex.unlock(); }
+
+protected:
+    std::mutex m_Mutex;
+};
+
+static bool isRelayed(const std::string &sCmd)
+{
+    return sCmd.find("!dome sendtoshutter") == 0 || sCmd == "!dome openshutter#" || sCmd == "!dome closeshutter#";
+}
+
+// answers everything, what goes to the shutter takes the radio link's time
+static bool answerAll(const std::string &sCmd, std::string &sResp, int &nDelayUs)
+{
+    if(isRelayed(sCmd))
+        nDelayUs += BENCH_RELAY_DELAY;
+    if(sCmd.find("!dome sendtoshutter") == 0) {
+        sResp = "!dome sendtoshutter:12.5#";
+        return true;
+    }
+    if(sCmd.find(" get") != std::string::npos || sCmd == "!dome status#" || sCmd == "!dome shutterstatus#" || sCmd.find("!seletek") == 0)
+        return false;
+    sResp = acknowledge(sCmd);
+    return true;
+}
+
+static int countRelays(CFakeSerX &Serx)
+{
+    std::vector<std::string> svCmds = Serx.GetCommands();
+    int nRelays = 0;
+
+    for(size_t i = 0; i < svCmds.size(); i++)
+        if(isRelayed(svCmds[i]))
+            nRelays++;
+    return nRelays;
+}
+
+// TheSkyX asking where the dome is every STRESS_SAMPLE_INTERVAL while the other
+// threads hold the host mutex and the port with gotos and slow shutter relays.
+static void stressGetAzEl(X2Dome &Dome, CFakeSerX &Serx, bool bLoaded, const char *pszName)
+{
+    CBenchSamples AzEl;
+    std::atomic<bool> bRunning(true);
+    std::vector<std::thread> Load;
+    BenchClock::time_point tEnd;
+    BenchClock::time_point tStart;
+    double dAz, dEl;
+
+    Serx.ClearCommands();
+    if(bLoaded) {
+        // gotos and their completion checks
+        Load.push_back(std::thread([&]() {
+            bool bComplete;
+            for(int i = 0; bRunning; i++) {
+                Dome.dapiGotoAzEl((i * 37) % 360, 0);
+                for(int j = 0; j < 5 && bRunning; j++) {
+                    Dome.dapiIsGotoComplete(&bComplete);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                }
+            }
+        }));
+        // shutter commands, relayed to the shutter
+        Load.push_back(std::thread([&]() {
+            bool bComplete;
+            while(bRunning) {
+                Dome.dapiOpen();
+                Dome.dapiIsOpenComplete(&bComplete);
+                Dome.dapiClose();
+                Dome.dapiIsCloseComplete(&bComplete);
+            }
+        }));
+    }
+
+    tEnd = BenchClock::now() + std::chrono::milliseconds(STRESS_DURATION);
+    while(BenchClock::now() < tEnd) {
+        tStart = BenchClock::now();
+        Dome.dapiGetAzEl(&dAz, &dEl);
+        AzEl.Add(elapsedUs(tStart));
+        std::this_thread::sleep_for(std::chrono::milliseconds(STRESS_SAMPLE_INTERVAL));
+    }
+    bRunning = false;
+    for(size_t i = 0; i < Load.size(); i++)
+        Load[i].join();
+    AzEl.Print(pszName);
+    printf("  %-40s %d commands, %d shutter relays\n", "", int(Serx.GetCommands().size()), countRelays(Serx));
+}
+
+static void benchGetAzElUnderLoad()
+{
+    // X2Dome owns and deletes its interfaces, like TheSkyX hands them over
+    CFakeSerX *pSerx = new CFakeSerX();
+    X2Dome Dome("", 0, pSerx, NULL, NULL, NULL, NULL, new CBenchMutex(), NULL);
+
+    printf("dapiGetAzEl every %d ms, status poller at %d ms, shutter relays taking %d us\n", STRESS_SAMPLE_INTERVAL, STATUS_POLL_INTERVAL, BENCH_RELAY_DELAY);
+    scriptController(*pSerx);
+    pSerx->SetHandler(answerAll);
+    pSerx->SetByteLatency(FAKE_BYTE_LATENCY_115200);
+    pSerx->SetResponseDelay(BENCH_CONTROLLER_DELAY);
+    if(Dome.establishLink() != SB_OK) {
+        printf("establishLink failed\n");
+        exit(1);
+    }
+    // let the poller take its first snapshot
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * STATUS_POLL_INTERVAL));
+
+    stressGetAzEl(Dome, *pSerx, false, "dapiGetAzEl idle");
+    stressGetAzEl(Dome, *pSerx, true, "dapiGetAzEl with gotos and shutter relays");
+    Dome.terminateLink();
+}
+
+int main()
+{
+    benchRoundTrips();
+    benchGetAzElUnderLoad();
+    return 0;
+}
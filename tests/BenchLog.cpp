@@ -0,0 +1,42 @@
+//
+//  BenchLog.cpp
+//  LunaticoBeaver X2 plugin tests
+//
+//  What the log statements cost domeCommand when logging is off. Built twice by
+//  "make bench" : BenchLog with logging off at runtime, BenchLogNoLog against a
+//  driver built with PLUGIN_NO_LOG where the statements are compiled out. The
+//  link answers instantly, so the numbers are the driver's own time in ns.
+
+#include "TestBeaver.h"
+#include "BenchSamples.h"
+
+#define LOG_BENCH_WARMUP    10000
+#define LOG_BENCH_ROUNDS    200000
+
+int main()
+{
+    CFakeSerX Serx;
+    CTestBeaver Beaver;
+    CBenchSamples Command;
+    std::string sResp;
+    BenchClock::time_point tStart;
+
+    connectBeaver(Beaver, Serx, 0, 0);
+    Beaver.setLogLevel(LOG_OFF);
+
+    // not a cached command, every call goes to the port
+    for(int i = 0; i < LOG_BENCH_WARMUP; i++)
+        Beaver.domeCommand("!domerot getstepsperdegree#", sResp);
+    for(int i = 0; i < LOG_BENCH_ROUNDS; i++) {
+        tStart = BenchClock::now();
+        Beaver.domeCommand("!domerot getstepsperdegree#", sResp);
+        Command.Add(elapsedNs(tStart));
+    }
+#ifdef PLUGIN_NO_LOG
+    Command.Print("domeCommand, logging compiled out", "ns");
+#else
+    Command.Print("domeCommand, logging off", "ns");
+#endif
+    Beaver.Disconnect();
+    return 0;
+}
@@ -0,0 +1,54 @@
+//
+//  BenchSamples.h
+//  LunaticoBeaver X2 plugin tests
+//
+//  Exact percentiles over all the samples of a benchmark, the plugin's
+//  CLatencyHistogram is only within 25%.
+
+#ifndef __BenchSamples__
+#define __BenchSamples__
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+typedef std::chrono::steady_clock BenchClock;
+
+class CBenchSamples
+{
+public:
+    void Add(long long nValue) { m_nvSamples.push_back(nValue); }
+
+    long long GetPercentile(double dPercentile)
+    {
+        size_t nRank;
+
+        if(m_nvSamples.empty())
+            return 0;
+        std::sort(m_nvSamples.begin(), m_nvSamples.end());
+        nRank = size_t(dPercentile / 100.0 * (m_nvSamples.size() - 1) + 0.5);
+        return m_nvSamples[nRank];
+    }
+
+    // pszUnit is what was added, "us" or "ns"
+    void Print(const char *pszName, const char *pszUnit = "us")
+    {
+        printf("  %-40s p50 %7lld %s   p99 %7lld %s   (%d samples)\n", pszName, GetPercentile(50), pszUnit, GetPercentile(99), pszUnit, int(m_nvSamples.size()));
+    }
+
+protected:
+    std::vector<long long> m_nvSamples;
+};
+
+inline long long elapsedUs(BenchClock::time_point tStart)
+{
+    return (long long)std::chrono::duration_cast<std::chrono::microseconds>(BenchClock::now() - tStart).count();
+}
+
+inline long long elapsedNs(BenchClock::time_point tStart)
+{
+    return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - tStart).count();
+}
+
+#endif
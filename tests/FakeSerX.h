@@ -0,0 +1,253 @@
+//
+//  FakeSerX.h
+//  LunaticoBeaver X2 plugin tests
+//
+//  Scripted stand-in for the TheSkyX serial port, so CLunaticoBeaver can be tested
+//  and benchmarked headless, without TheSkyX or a controller.
+//  Each command written ("...#") is answered from a table, or by a handler for the
+//  ones that need some state. The answer comes back the way it would on the wire :
+//  the command takes nByteLatency us per byte to go out, the controller takes the
+//  response delay, then the answer arrives one byte every nByteLatency us.
+//  bytesWaitingRx and readFile hand out at most nChunk bytes at a time, so
+//  readResponse sees its partial reads.
+//  Thread safe.
+
+#ifndef __FakeSerX__
+#define __FakeSerX__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#include "../../../licensedinterfaces/sberrorx.h"
+#include "../../../licensedinterfaces/serxinterface.h"
+
+#define FAKE_BYTE_LATENCY_115200    87  // us per byte at 115200 8N1
+
+class CFakeSerX : public SerXInterface
+{
+public:
+    // sCmd with its '#'. Fill in sResp (with its '#') and return true to answer, nDelayUs
+    // comes in as the response delay and can be changed for this command.
+    typedef std::function<bool(const std::string &sCmd, std::string &sResp, int &nDelayUs)> ResponseHandler;
+
+    CFakeSerX() : m_bOpen(false), m_nByteLatency(0), m_nResponseDelay(0), m_nChunk(0) { }
+
+    // sResp is sent back as is. A command with no answer times out, like on a dead link.
+    void SetResponse(const std::string &sCmd, const std::string &sResp)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Responses[sCmd] = sResp;
+    }
+
+    // asked before the table
+    void SetHandler(ResponseHandler Handler)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Handler = Handler;
+    }
+
+    // us per byte each way, FAKE_BYTE_LATENCY_115200 for the real link, 0 for none
+    void SetByteLatency(int nUs) { std::lock_guard<std::mutex> lock(m_Mutex); m_nByteLatency = nUs; }
+    // us between the end of a command and the first byte of its answer
+    void SetResponseDelay(int nUs) { std::lock_guard<std::mutex> lock(m_Mutex); m_nResponseDelay = nUs; }
+    // most bytes bytesWaitingRx and readFile report at once, 0 for no limit
+    void SetChunkSize(int nBytes) { std::lock_guard<std::mutex> lock(m_Mutex); m_nChunk = nBytes; }
+
+    // commands received, in order
+    std::vector<std::string> GetCommands()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Commands;
+    }
+
+    void ClearCommands()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Commands.clear();
+    }
+
+    int CountCommands(const std::string &sCmd)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return (int)std::count(m_Commands.begin(), m_Commands.end(), sCmd);
+    }
+
+    // SerXInterface
+
+    int open(const char* pszPort, const unsigned long& dwBaudRate = 9600, const Parity& parity = B_NOPARITY, const char* pszSession = 0)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bOpen = true;
+        return SB_OK;
+    }
+
+    int close()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bOpen = false;
+        return SB_OK;
+    }
+
+    bool isConnected(void) const { return m_bOpen; }
+
+    int flushTx(void) { return SB_OK; }
+
+    // bytes still on their way arrive after the purge, like a late answer on the real link
+    int purgeTxRx(void)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Rx.erase(m_Rx.begin(), m_Rx.begin() + readyBytes(Clock::now()));
+        m_sTx.clear();
+        return SB_OK;
+    }
+
+    int waitForBytesRx(const int& nNumber, const int& nTimeOutMilli)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        return waitForBytes(lock, size_t(nNumber), Clock::now() + std::chrono::milliseconds(nTimeOutMilli)) >= size_t(nNumber) ? SB_OK : ERR_RXTIMEOUT;
+    }
+
+    int bytesWaitingRx(int &nNumber)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        nNumber = (int)chunk(readyBytes(Clock::now()));
+        return SB_OK;
+    }
+
+    int bytesWaitingTx(int &nNumber)
+    {
+        nNumber = 0;
+        return SB_OK;
+    }
+
+    // returns once the bytes asked for, or a chunk of them, are there. Fewer on timeout.
+    int readFile(void* lpBuffer, const unsigned long dwNumberOfBytesToRead, unsigned long& lNumberOfBytesRead, const unsigned long& dwTimeOut = 1000)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        size_t nWanted = chunk(dwNumberOfBytesToRead);
+        size_t nReady;
+
+        nReady = waitForBytes(lock, nWanted, Clock::now() + std::chrono::milliseconds(dwTimeOut));
+        lNumberOfBytesRead = (unsigned long)std::min(nReady, nWanted);
+        for(unsigned long i = 0; i < lNumberOfBytesRead; i++) {
+            ((char *)lpBuffer)[i] = m_Rx.front().cByte;
+            m_Rx.pop_front();
+        }
+        return SB_OK;
+    }
+
+    int writeFile(void* lpBuffer, const unsigned long& dwNumberOfBytesToWrite, unsigned long& lNumberOfBytesWritten)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        Clock::time_point tSent = Clock::now();
+        size_t nTermPos;
+        std::string sCmd;
+        std::string sResp;
+        int nDelay;
+        bool bAnswered;
+
+        m_sTx.append((const char *)lpBuffer, dwNumberOfBytesToWrite);
+        lNumberOfBytesWritten = dwNumberOfBytesToWrite;
+
+        while((nTermPos = m_sTx.find('#')) != std::string::npos) {
+            sCmd = m_sTx.substr(0, nTermPos + 1);
+            m_sTx.erase(0, nTermPos + 1);
+            m_Commands.push_back(sCmd);
+            tSent += std::chrono::microseconds((long long)m_nByteLatency * sCmd.size());
+
+            // the handler may take its time, the driver holds the port anyway
+            nDelay = m_nResponseDelay;
+            sResp.clear();
+            bAnswered = false;
+            if(m_Handler) {
+                ResponseHandler Handler = m_Handler;
+                lock.unlock();
+                bAnswered = Handler(sCmd, sResp, nDelay);
+                lock.lock();
+            }
+            if(!bAnswered && m_Responses.count(sCmd))
+                sResp = m_Responses[sCmd];
+            queueResponse(sResp, tSent + std::chrono::microseconds(nDelay));
+        }
+        m_RxReady.notify_all();
+        return SB_OK;
+    }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    struct RxByte {
+        char                cByte;
+        Clock::time_point   tReady;
+    };
+
+    // called with m_Mutex held, answers arrive in order
+    void queueResponse(const std::string &sResp, Clock::time_point tStart)
+    {
+        Clock::time_point tReady;
+
+        if(!m_Rx.empty() && m_Rx.back().tReady > tStart)
+            tStart = m_Rx.back().tReady;
+        for(size_t i = 0; i < sResp.size(); i++) {
+            tReady = tStart + std::chrono::microseconds((long long)m_nByteLatency * (i + 1));
+            m_Rx.push_back({sResp[i], tReady});
+        }
+    }
+
+    // called with m_Mutex held
+    size_t readyBytes(Clock::time_point tNow)
+    {
+        size_t nReady = 0;
+
+        while(nReady < m_Rx.size() && m_Rx[nReady].tReady <= tNow)
+            nReady++;
+        return nReady;
+    }
+
+    size_t chunk(size_t nBytes)
+    {
+        return m_nChunk > 0 ? std::min(nBytes, size_t(m_nChunk)) : nBytes;
+    }
+
+    // bytes ready when nWanted are, or at tDeadline
+    size_t waitForBytes(std::unique_lock<std::mutex> &lock, size_t nWanted, Clock::time_point tDeadline)
+    {
+        size_t nReady;
+        Clock::time_point tNow;
+
+        while(true) {
+            tNow = Clock::now();
+            nReady = readyBytes(tNow);
+            if(nReady >= nWanted || tNow >= tDeadline)
+                return nReady;
+            // next byte on its way, or nothing until the next command
+            if(nReady < m_Rx.size())
+                m_RxReady.wait_until(lock, std::min(tDeadline, m_Rx[nReady].tReady));
+            else
+                m_RxReady.wait_until(lock, tDeadline);
+        }
+    }
+
+    std::mutex                          m_Mutex;
+    std::condition_variable             m_RxReady;
+    std::atomic<bool>                   m_bOpen;
+    int                                 m_nByteLatency;     // us
+    int                                 m_nResponseDelay;   // us
+    int                                 m_nChunk;
+    std::map<std::string, std::string>  m_Responses;
+    ResponseHandler                     m_Handler;
+    std::string                         m_sTx;              // partial command
+    std::deque<RxByte>                  m_Rx;
+    std::vector<std::string>            m_Commands;
+};
+
+#endif
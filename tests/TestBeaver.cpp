@@ -0,0 +1,179 @@
+//
+//  TestBeaver.cpp
+//  LunaticoBeaver X2 plugin tests
+//
+//  Headless checks of CLunaticoBeaver against the scripted serial port.
+//  "make test", exits with the number of failed checks.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "TestBeaver.h"
+
+static int nChecks = 0;
+static int nFailed = 0;
+
+#define CHECK(bCondition) \
+    do { \
+        nChecks++; \
+        if(!(bCondition)) { \
+            nFailed++; \
+            printf("  FAILED %s:%d : %s\n", __FILE__, __LINE__, #bCondition); \
+        } \
+    } while(0)
+
+typedef std::chrono::steady_clock TestClock;
+
+static long long elapsedMs(TestClock::time_point tStart)
+{
+    return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(TestClock::now() - tStart).count();
+}
+
+#pragma mark - transport
+
+// every chunk size readResponse can be handed, down to one byte per read
+static void testChunkedResponses()
+{
+    printf("chunked responses\n");
+    for(int nChunk = 0; nChunk <= 8; nChunk++) {
+        CFakeSerX Serx;
+        CTestBeaver Beaver;
+        double dAz = 0;
+        std::vector<double> dvValues;
+
+        scriptController(Serx);
+        Serx.SetHandler(acknowledgeSets);
+        Serx.SetByteLatency(FAKE_BYTE_LATENCY_115200);
+        Serx.SetChunkSize(nChunk);
+        Serx.SetResponse("!dome getaz#", "!dome getaz:123.45#");
+        Beaver.setSerxPointer(&Serx);
+        Beaver.setStatusPollInterval(0);
+
+        CHECK(Beaver.Connect("fake") == PLUGIN_OK);
+        CHECK(Beaver.getHomeAz() == 90.0);
+        CHECK(Beaver.getParkAz() == 180.0);
+        Beaver.clearResponseCache();
+        CHECK(Beaver.getDomeAz(dAz) == PLUGIN_OK);
+        CHECK(fabs(dAz - 123.45) < 1e-9);
+        // several answers back to back, split on their terminators
+        Beaver.clearResponseCache();
+        CHECK(Beaver.getValues({"!domerot getminspeed#", "!domerot getmaxspeed#", "!domerot getacceleration#"}, dvValues) == PLUGIN_OK);
+        CHECK(dvValues.size() == 3 && dvValues[0] == 100 && dvValues[1] == 800 && dvValues[2] == 200);
+        Beaver.Disconnect();
+    }
+}
+
+// a slow answer times out, and once it has landed the next command's purge drops it
+static void testLateResponse()
+{
+    CFakeSerX Serx;
+    CTestBeaver Beaver;
+    std::atomic<bool> bSlow(false);
+    std::string sResp;
+    TestClock::time_point tStart;
+
+    printf("late response\n");
+    scriptController(Serx);
+    Serx.SetHandler([&](const std::string &sCmd, std::string &sResp, int &nDelayUs) {
+        if(bSlow && sCmd == "!domerot getmaxspeed#") {
+            sResp = "!domerot getmaxspeed:999#";
+            nDelayUs = (MAX_TIMEOUT + 200) * 1000;
+            return true;
+        }
+        return acknowledgeSets(sCmd, sResp, nDelayUs);
+    });
+    Serx.SetByteLatency(FAKE_BYTE_LATENCY_115200);
+    Beaver.setSerxPointer(&Serx);
+    Beaver.setStatusPollInterval(0);
+    CHECK(Beaver.Connect("fake") == PLUGIN_OK);
+    // Connect read the speeds, they have to go out again
+    Beaver.clearResponseCache();
+    bSlow = true;
+
+    tStart = TestClock::now();
+    CHECK(Beaver.domeCommand("!domerot getmaxspeed#", sResp) == COMMAND_TIMEOUT);
+    CHECK(elapsedMs(tStart) < MAX_TIMEOUT + 100);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK(Beaver.domeCommand("!domerot getminspeed#", sResp) == PLUGIN_OK);
+    CHECK(sResp == "!domerot getminspeed:100");
+    Beaver.Disconnect();
+}
+
+// a dead link fails within the timeout instead of hanging the caller
+static void testNoResponse()
+{
+    CFakeSerX Serx;
+    CTestBeaver Beaver;
+    std::string sResp;
+    TestClock::time_point tStart;
+
+    printf("no response\n");
+    scriptController(Serx);
+    Serx.SetHandler(acknowledgeSets);
+    Beaver.setSerxPointer(&Serx);
+    Beaver.setStatusPollInterval(0);
+    CHECK(Beaver.Connect("fake") == PLUGIN_OK);
+
+    tStart = TestClock::now();
+    CHECK(Beaver.domeCommand("!dome unknown#", sResp) == COMMAND_TIMEOUT);
+    CHECK(elapsedMs(tStart) >= MAX_TIMEOUT - 10);
+    CHECK(elapsedMs(tStart) < MAX_TIMEOUT + 100);
+    Beaver.Disconnect();
+}
+
+#pragma mark - rain reaction
+
+// a close that gets no answer is sent again while it rains
+static void testRainCloseRetry()
+{
+    CFakeSerX Serx;
+    CTestBeaver Beaver;
+    std::atomic<int> nCloseAnswers(0);
+    std::atomic<bool> bClosing(false);
+    TestClock::time_point tStart;
+
+    printf("rain close retry\n");
+    scriptController(Serx);
+    Serx.SetHandler([&](const std::string &sCmd, std::string &sResp, int &nDelayUs) {
+        if(sCmd == "!dome status#") {
+            // raining, shutter open until a close goes through
+            sResp = bClosing ? "!dome status:1088#" : "!dome status:192#";
+            return true;
+        }
+        if(sCmd == "!dome closeshutter#") {
+            // the first one is lost on the link
+            if(nCloseAnswers++ == 0)
+                return true;
+            bClosing = true;
+            sResp = "!dome closeshutter:0#";
+            return true;
+        }
+        return acknowledgeSets(sCmd, sResp, nDelayUs);
+    });
+    Beaver.setSerxPointer(&Serx);
+    Beaver.setStatusPollInterval(0);
+    Beaver.setRainReaction(DO_NOTHING, true);
+    CHECK(Beaver.Connect("fake") == PLUGIN_OK);
+
+    tStart = TestClock::now();
+    while(!bClosing && elapsedMs(tStart) < RAIN_RETRY_INTERVAL + 3000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(bClosing);
+    CHECK(Serx.CountCommands("!dome closeshutter#") == 2);
+    // closing now, no more tries
+    std::this_thread::sleep_for(std::chrono::milliseconds(RAIN_RETRY_INTERVAL + 500));
+    CHECK(Serx.CountCommands("!dome closeshutter#") == 2);
+    Beaver.Disconnect();
+}
+
+int main()
+{
+    testChunkedResponses();
+    testLateResponse();
+    testNoResponse();
+    testRainCloseRetry();
+
+    printf("%d checks, %d failed\n", nChecks, nFailed);
+    return nFailed;
+}
@@ -0,0 +1,81 @@
+//
+//  TestBeaver.h
+//  LunaticoBeaver X2 plugin tests
+//
+//  What the tests and the benchmarks share : a controller scripted on the fake
+//  serial port, and access to the protected transport of CLunaticoBeaver.
+
+#ifndef __TestBeaver__
+#define __TestBeaver__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LunaticoBeaver.h"
+#include "FakeSerX.h"
+
+// the transport is protected, the tests reach it through a subclass
+class CTestBeaver : public CLunaticoBeaver
+{
+public:
+    using CLunaticoBeaver::domeCommand;
+    using CLunaticoBeaver::domeCommandBatch;
+    using CLunaticoBeaver::getValues;
+    using CLunaticoBeaver::getDomeAz;
+    using CLunaticoBeaver::getDomeStatus;
+    using CLunaticoBeaver::getResponseField;
+    using CLunaticoBeaver::parseValue;
+};
+
+// What Connect and the status reads ask for, on a dome parked at 180 with its
+// shutter closed. Set commands are acknowledged by the handler of each test.
+inline void scriptController(CFakeSerX &Serx)
+{
+    Serx.SetResponse("!seletek version#",               "!seletek version:2510#");
+    Serx.SetResponse("!domerot getpark#",               "!domerot getpark:180.00#");
+    Serx.SetResponse("!domerot gethome#",               "!domerot gethome:90.00#");
+    Serx.SetResponse("!dome getshutterenable#",         "!dome getshutterenable:1#");
+    Serx.SetResponse("!domerot getminspeed#",           "!domerot getminspeed:100#");
+    Serx.SetResponse("!domerot getmaxspeed#",           "!domerot getmaxspeed:800#");
+    Serx.SetResponse("!domerot getacceleration#",       "!domerot getacceleration:200#");
+    Serx.SetResponse("!domerot getstepsperdegree#",     "!domerot getstepsperdegree:100.5#");
+    Serx.SetResponse("!dome getaz#",                    "!dome getaz:180.00#");
+    Serx.SetResponse("!dome status#",                   "!dome status:4352#");  // closed, at park
+}
+
+// "!domerot setmaxspeed 800#" -> "!domerot setmaxspeed:0#"
+inline std::string acknowledge(const std::string &sCmd)
+{
+    size_t nVerbEnd;
+
+    nVerbEnd = sCmd.find(' ', sCmd.find(' ') + 1);
+    if(nVerbEnd == std::string::npos)
+        nVerbEnd = sCmd.size() - 1;
+    return sCmd.substr(0, nVerbEnd) + ":0#";
+}
+
+// handler acknowledging the set and abort commands, the rest comes from the table
+inline bool acknowledgeSets(const std::string &sCmd, std::string &sResp, int &nDelayUs)
+{
+    if(sCmd.find(" set") == std::string::npos && sCmd.find("!dome abort") != 0)
+        return false;
+    sResp = acknowledge(sCmd);
+    return true;
+}
+
+// connected to the scripted controller with the status poller off, exits if it can't
+inline void connectBeaver(CTestBeaver &Beaver, CFakeSerX &Serx, int nByteLatency, int nResponseDelay)
+{
+    scriptController(Serx);
+    Serx.SetHandler(acknowledgeSets);
+    Serx.SetByteLatency(nByteLatency);
+    Serx.SetResponseDelay(nResponseDelay);
+    Beaver.setSerxPointer(&Serx);
+    Beaver.setStatusPollInterval(0);
+    if(Beaver.Connect("fake") != PLUGIN_OK) {
+        printf("Connect failed\n");
+        exit(1);
+    }
+}
+
+#endif
@@ -23,21 +23,47 @@ X2Dome::X2Dome(const char* pszSelection, const int& nISIndex,
 	m_bLinked = false;
     m_bCalibratingDome = false;
     m_bCalibratingShutter = false;
-    m_nBattRequest = 0;
+    m_ControllerSettings = DomeSettings();
     m_bSettingPanID = false;
     m_bHasShutterControl = false;
     
     m_LunaticoBeaver.setSerxPointer(pSerX);
+    m_LunaticoBeaver.setLoggerPointer(pLogger);
     if (m_pIniUtil)
     {
         m_bLogRainStatus = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LOG_RAIN_STATUS, false);
         m_LunaticoBeaver.enableRainStatusFile(m_bLogRainStatus);
+        m_LunaticoBeaver.setStatusPollInterval(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_POLL_INTERVAL, STATUS_POLL_INTERVAL));
+        // LogLevel : 0 off, 1 info, 2 debug, 3 trace. LogCategories : 1 transport, 2 state, 4 rain, 8 ui
+        m_LunaticoBeaver.setLogLevel(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LOG_LEVEL, m_LunaticoBeaver.getLogLevel()),
+                                     m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LOG_CATEGORIES, m_LunaticoBeaver.getLogCategories()));
+        // what was learned about this dome's goto accuracy in previous sessions
+        char szToleranceStats[TOLERANCE_STATS_SIZE];
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_GOTO_TOLERANCE, "", szToleranceStats, TOLERANCE_STATS_SIZE);
+        m_LunaticoBeaver.setGotoToleranceStats(szToleranceStats);
+        // SlitWidth in degrees of azimuth, 0 sends every goto. TrackingDeadband in percent of the slit width, TrackingLead in percent of the deadband
+        m_LunaticoBeaver.setTrackingDeadband(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_SLIT_WIDTH, 0),
+                                             m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TRACKING_DEADBAND, DEADBAND_DEFAULT_PERCENT),
+                                             m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TRACKING_LEAD, DEADBAND_LEAD_PERCENT));
+        // RainAction : 0 nothing, 1 home, 2 park. Sample interval and debounce in ms
+        m_LunaticoBeaver.setRainReaction(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_RAIN_ACTION, DO_NOTHING),
+                                         m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_RAIN_CLOSE_SHUTTER, false),
+                                         m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_RAIN_SAMPLE_INTERVAL, RAIN_SAMPLE_INTERVAL),
+                                         m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_RAIN_DEBOUNCE, RAIN_DEBOUNCE));
+        // shared memory status for local tools, see Telemetry.h. Off unless asked for
+        m_LunaticoBeaver.enableTelemetry(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TELEMETRY, false));
+        // relay messages per minute to the shutter, see ShutterLink.h
+        m_LunaticoBeaver.setShutterLinkBudget(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SHUTTER_LINK_BUDGET, SHUTTER_LINK_BUDGET));
     }
 }
 
 
 X2Dome::~X2Dome()
 {
+    // stop the status poller before the interfaces it uses go away
+    if(m_bLinked)
+        m_LunaticoBeaver.Disconnect();
+
 	if (m_pSerX)
 		delete m_pSerX;
 	if (m_pTheSkyX)
@@ -132,6 +158,11 @@ int X2Dome::execModalSettingsDialog()
     int nSAcc;
     double  batShutCutOff;
     bool bShutterDetected;
+    DomeSettings NewSettings;
+    double dGotoTolerance;
+    unsigned long nGotos;
+    int nLogLevel;
+    int nLogCategories;
 
     if (NULL == ui)
         return ERR_POINTER;
@@ -168,8 +199,15 @@ int X2Dome::execModalSettingsDialog()
         dx->setEnabled("ticksPerRev",true);
         n_nbStepPerRev = m_LunaticoBeaver.getDomeStepPerRev();
         dx->setPropertyInt("ticksPerRev","value", n_nbStepPerRev);
+        m_ControllerSettings.nStepsPerRev = n_nbStepPerRev;
+
+        m_LunaticoBeaver.isShutterDetected(bShutterDetected);
 
-        m_LunaticoBeaver.getRotationSpeed(nRMinSpeed, nRMaxSpeed, nRAcc);
+        // read all the speeds in one go if we have a shutter
+        if(m_bHasShutterControl && bShutterDetected)
+            m_LunaticoBeaver.getSpeeds(nRMinSpeed, nRMaxSpeed, nRAcc, nSMinSpeed, nSMaxSpeed, nSAcc);
+        else
+            m_LunaticoBeaver.getRotationSpeed(nRMinSpeed, nRMaxSpeed, nRAcc);
 
         dx->setEnabled("rotationMinSpeed",true);
         dx->setPropertyInt("rotationMinSpeed","value", nRMinSpeed);
@@ -179,12 +217,12 @@ int X2Dome::execModalSettingsDialog()
 
         dx->setEnabled("rotationAcceletation",true);
         dx->setPropertyInt("rotationAcceletation","value", nRAcc);
-
-        m_LunaticoBeaver.isShutterDetected(bShutterDetected);
+        m_ControllerSettings.nRotMinSpeed = nRMinSpeed;
+        m_ControllerSettings.nRotMaxSpeed = nRMaxSpeed;
+        m_ControllerSettings.nRotAccel = nRAcc;
 
         if(m_bHasShutterControl && bShutterDetected) {
             dx->setEnabled("pushButton_3", true);
-            m_LunaticoBeaver.getShutterSpeed(nSMinSpeed, nSMaxSpeed, nSAcc);
 
             dx->setEnabled("shutterMinSpeed",true);
             dx->setPropertyInt("shutterMinSpeed","value", nSMinSpeed);
@@ -200,6 +238,10 @@ int X2Dome::execModalSettingsDialog()
 
             m_LunaticoBeaver.getBatteryLevels( dShutterBattery, dShutterCutOff);
             dx->setPropertyDouble("lowShutBatCutOff", "value", dShutterCutOff);
+            m_ControllerSettings.nShutMinSpeed = nSMinSpeed;
+            m_ControllerSettings.nShutMaxSpeed = nSMaxSpeed;
+            m_ControllerSettings.nShutAccel = nSAcc;
+            m_ControllerSettings.dShutterCutOff = dShutterCutOff;
 
             if(dShutterBattery>=0.0f)
                 ssTmpBuf << std::fixed << std::setprecision(2) << dShutterBattery << " V";
@@ -219,6 +261,10 @@ int X2Dome::execModalSettingsDialog()
             dx->setText("shutterPresent", "<html><head/><body><p><span style=\" color:#FF0000;\">Not detected</span></p></body></html>");
             dx->setPropertyDouble("lowShutBatCutOff","value", 0);
             dx->setPropertyString("shutterBatteryLevel","text", "--");
+            m_ControllerSettings.nShutMinSpeed = 0;
+            m_ControllerSettings.nShutMaxSpeed = 0;
+            m_ControllerSettings.nShutAccel = 0;
+            m_ControllerSettings.dShutterCutOff = 0;
         }
 
         nErr = m_LunaticoBeaver.getRainSensorStatus(nRainSensorStatus);
@@ -252,16 +298,31 @@ int X2Dome::execModalSettingsDialog()
         dx->setPropertyString("domePointingError", "text", "--");
         dx->setPropertyString("rainStatus","text", "--");
     }
-    dx->setPropertyDouble("homePosition","value", m_LunaticoBeaver.getHomeAz());
-    dx->setPropertyDouble("parkPosition","value", m_LunaticoBeaver.getParkAz());
-
-
-    m_nBattRequest = 0;
+    m_LunaticoBeaver.getGotoTolerance(dGotoTolerance, nGotos);
+    ssTmpBuf << std::fixed << std::setprecision(2) << dGotoTolerance << " deg (" << nGotos << " gotos)";
+    dx->setPropertyString("gotoTolerance","text", ssTmpBuf.str().c_str());
+    std::stringstream().swap(ssTmpBuf);
+    m_ControllerSettings.dHomeAz = m_LunaticoBeaver.getHomeAz();
+    m_ControllerSettings.dParkAz = m_LunaticoBeaver.getParkAz();
+    dx->setPropertyDouble("homePosition","value", m_ControllerSettings.dHomeAz);
+    dx->setPropertyDouble("parkPosition","value", m_ControllerSettings.dParkAz);
+
+    // the log filter follows the controls while the dialog is up, Cancel puts it back
+    nLogLevel = m_LunaticoBeaver.getLogLevel();
+    nLogCategories = m_LunaticoBeaver.getLogCategories();
+    dx->setCurrentIndex("logLevel", nLogLevel);
+    dx->setChecked("logTransport", (nLogCategories & LOG_TRANSPORT) ? 1 : 0);
+    dx->setChecked("logState", (nLogCategories & LOG_STATE) ? 1 : 0);
+    dx->setChecked("logRain", (nLogCategories & LOG_RAIN) ? 1 : 0);
+    dx->setChecked("logUI", (nLogCategories & LOG_UI) ? 1 : 0);
 
     //Display the user interface
     if ((nErr = ui->exec(bPressedOK)))
         return nErr;
 
+    if (!bPressedOK)
+        m_LunaticoBeaver.setLogLevel(nLogLevel, nLogCategories);
+
     //Retreive values from the user interface
     if (bPressedOK) {
         dx->propertyInt("ticksPerRev", "value", n_nbStepPerRev);
@@ -276,21 +337,28 @@ int X2Dome::execModalSettingsDialog()
         dx->propertyDouble("lowShutBatCutOff", "value", batShutCutOff);
         m_bLogRainStatus = dx->isChecked("checkBox");
         m_LunaticoBeaver.enableRainStatusFile(m_bLogRainStatus);
+        applyLogFilter(dx);
 
         if(m_bLinked) {
-            m_LunaticoBeaver.setHomeAz(dHomeAz);
-            m_LunaticoBeaver.setParkAz(dParkAz);
-            m_LunaticoBeaver.setDomeStepPerRev(n_nbStepPerRev);
-            m_LunaticoBeaver.setRotationSpeed(nRMinSpeed, nRMaxSpeed, nRAcc);
-			if(m_bHasShutterControl) {
-				m_LunaticoBeaver.setShutterSpeed(nSMinSpeed, nSMaxSpeed, nSAcc);
-                m_LunaticoBeaver.setBatteryCutOff(batShutCutOff);
-			}
+            NewSettings = m_ControllerSettings;
+            NewSettings.dHomeAz = dHomeAz;
+            NewSettings.dParkAz = dParkAz;
+            NewSettings.nStepsPerRev = n_nbStepPerRev;
+            NewSettings.nRotMinSpeed = nRMinSpeed;
+            NewSettings.nRotMaxSpeed = nRMaxSpeed;
+            NewSettings.nRotAccel = nRAcc;
+            NewSettings.bShutter = m_bHasShutterControl;
+            NewSettings.nShutMinSpeed = nSMinSpeed;
+            NewSettings.nShutMaxSpeed = nSMaxSpeed;
+            NewSettings.nShutAccel = nSAcc;
+            NewSettings.dShutterCutOff = batShutCutOff;
+            // only send what changed, and save to eeprom only if something was written
+            m_LunaticoBeaver.applySettings(m_ControllerSettings, NewSettings);
         }
-        // save settings to eeprom
-        m_LunaticoBeaver.saveSettingsToEEProm();
         // save the values to persistent storage
         nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_LOG_RAIN_STATUS, m_bLogRainStatus);
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_LOG_LEVEL, m_LunaticoBeaver.getLogLevel());
+        nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_LOG_CATEGORIES, m_LunaticoBeaver.getLogCategories());
     }
     return nErr;
 
@@ -326,6 +394,9 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
             if(bShutterDetected) {
                 uiex->setText("shutterPresent", "<html><head/><body><p><span style=\" color:#00FF00;\">Detected</span></p></body></html>");
                 m_LunaticoBeaver.getShutterSpeed(nMinSpeed, nMaxSpeed, nAcc);
+                m_ControllerSettings.nShutMinSpeed = nMinSpeed;
+                m_ControllerSettings.nShutMaxSpeed = nMaxSpeed;
+                m_ControllerSettings.nShutAccel = nAcc;
                 uiex->setEnabled("shutterMinSpeed",true);
                 uiex->setPropertyInt("shutterMinSpeed","value", nMinSpeed);
                 uiex->setEnabled("shutterSpeed",true);
@@ -343,6 +414,9 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
                 uiex->setEnabled("shutterSpeed",false);
                 uiex->setEnabled("shutterAcceleration",false);
                 uiex->setPropertyString("shutterBatteryLevel","text", "--");
+                m_ControllerSettings.nShutMinSpeed = 0;
+                m_ControllerSettings.nShutMaxSpeed = 0;
+                m_ControllerSettings.nShutAccel = 0;
             }
         }
 
@@ -377,7 +451,8 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
 				uiex->setText("pushButton", "Calibrate");
                 uiex->setEnabled("pushButton_3", true);
                 // read step per rev from controller
-                uiex->setPropertyInt("ticksPerRev","value", m_LunaticoBeaver.getDomeStepPerRev());
+                m_ControllerSettings.nStepsPerRev = m_LunaticoBeaver.getDomeStepPerRev();
+                uiex->setPropertyInt("ticksPerRev","value", m_ControllerSettings.nStepsPerRev);
 			}
 
             else if(m_bCalibratingShutter && m_DomeCalibrationTimer.GetElapsedSeconds()>=5) {
@@ -412,20 +487,19 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
             }
 
             else if(m_bHasShutterControl && !m_bCalibratingDome && !m_bCalibratingShutter) {
-                // don't ask to often
-                if (!(m_nBattRequest%4)) {
-                    m_LunaticoBeaver.getBatteryLevels(dShutterBattery, dShutterCutOff);
-                    if(dShutterCutOff < 1.0f) // not right.. ask again
-                        m_LunaticoBeaver.getBatteryLevels(dShutterBattery, dShutterCutOff);
-                        if(dShutterBattery>=0.0f)
-                            ssTmpBuf << std::fixed << std::setprecision(2) << dShutterBattery << " V";
-                        else
-                            ssTmpBuf << "--";
-                        uiex->setPropertyString("shutterBatteryLevel","text", ssTmpBuf.str().c_str());
-                        uiex->setPropertyDouble("lowShutBatCutOff","value", dShutterCutOff);
-                        std::stringstream().swap(ssTmpBuf);
+                // cached by the driver, this doesn't go to the shutter on every tick
+                m_LunaticoBeaver.getBatteryLevels(dShutterBattery, dShutterCutOff);
+                if(dShutterBattery>=0.0f)
+                    ssTmpBuf << std::fixed << std::setprecision(2) << dShutterBattery << " V";
+                else
+                    ssTmpBuf << "--";
+                uiex->setPropertyString("shutterBatteryLevel","text", ssTmpBuf.str().c_str());
+                // only when the shutter changed it, so the field isn't reset under the user's edit every tick
+                if(dShutterCutOff != m_ControllerSettings.dShutterCutOff) {
+                    uiex->setPropertyDouble("lowShutBatCutOff","value", dShutterCutOff);
+                    m_ControllerSettings.dShutterCutOff = dShutterCutOff;
                 }
-                m_nBattRequest++;
+                std::stringstream().swap(ssTmpBuf);
                 nErr = m_LunaticoBeaver.getRainSensorStatus(nRainSensorStatus);
                 if(nErr)
                     uiex->setPropertyString("rainStatus","text", "--");
@@ -512,6 +586,13 @@ void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
         }
     }
 
+    if (!strcmp(pszEvent, "on_logLevel_currentIndexChanged") ||
+        !strcmp(pszEvent, "on_logTransport_stateChanged") ||
+        !strcmp(pszEvent, "on_logState_stateChanged") ||
+        !strcmp(pszEvent, "on_logRain_stateChanged") ||
+        !strcmp(pszEvent, "on_logUI_stateChanged"))
+        applyLogFilter(uiex);
+
     if (!strcmp(pszEvent, "on_checkBox_2_stateChanged")) {
         bShutterPresent = uiex->isChecked("checkBox_2");
         m_LunaticoBeaver.setShutterPresent(bShutterPresent);
@@ -611,6 +692,10 @@ int X2Dome::dapiGetAzEl(double* pdAz, double* pdEl)
     if(!m_bLinked)
         return ERR_NOLINK;
 
+    // served from the status poller without waiting for the command in progress
+    if(m_LunaticoBeaver.getCachedAzEl(*pdAz, *pdEl))
+        return SB_OK;
+
 	X2MutexLocker ml(GetMutex());
 
     *pdAz = m_LunaticoBeaver.getCurrentAz();
@@ -640,6 +725,9 @@ int X2Dome::dapiAbort(void)
     if(!m_bLinked)
         return ERR_NOLINK;
 
+    // stop the dome first, the command holding the host mutex may take a while
+    m_LunaticoBeaver.sendAbort();
+
 	X2MutexLocker ml(GetMutex());
 
     m_LunaticoBeaver.abortCurrentCommand();
@@ -749,6 +837,7 @@ int X2Dome::dapiIsGotoComplete(bool* pbComplete)
 	X2MutexLocker ml(GetMutex());
 
 	nErr = m_LunaticoBeaver.isGoToComplete(*pbComplete);
+    saveGotoTolerance();
     if(nErr)
         return ERR_CMDFAILED;
     return SB_OK;
@@ -896,5 +985,30 @@ void X2Dome::portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const
 
 }
 
+// the learned goto tolerance only changes when a goto completes, so only save it then.
+void X2Dome::saveGotoTolerance()
+{
+    std::string sStats;
+
+    if(m_pIniUtil && m_LunaticoBeaver.getGotoToleranceStats(sStats))
+        m_pIniUtil->writeString(PARENT_KEY, CHILD_KEY_GOTO_TOLERANCE, sStats.c_str());
+}
+
+// logLevel is in LOG_OFF .. LOG_TRACE order
+void X2Dome::applyLogFilter(X2GUIExchangeInterface *uiex)
+{
+    int nCategories = 0;
+
+    if(uiex->isChecked("logTransport"))
+        nCategories |= LOG_TRANSPORT;
+    if(uiex->isChecked("logState"))
+        nCategories |= LOG_STATE;
+    if(uiex->isChecked("logRain"))
+        nCategories |= LOG_RAIN;
+    if(uiex->isChecked("logUI"))
+        nCategories |= LOG_UI;
+    m_LunaticoBeaver.setLogLevel(uiex->currentIndex("logLevel"), nCategories);
+}
+
 
 
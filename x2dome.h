@@ -25,6 +25,19 @@
 #define CHILD_KEY_HOME_ON_PARK "HomeOnPark"
 #define CHILD_KEY_HOME_ON_UNPARK "HomeOnUnpark"
 #define CHILD_KEY_LOG_RAIN_STATUS "LogRainStatus"
+#define CHILD_KEY_POLL_INTERVAL "StatusPollInterval"
+#define CHILD_KEY_LOG_LEVEL "LogLevel"
+#define CHILD_KEY_LOG_CATEGORIES "LogCategories"
+#define CHILD_KEY_GOTO_TOLERANCE "GotoToleranceStats"
+#define CHILD_KEY_SLIT_WIDTH "SlitWidth"
+#define CHILD_KEY_TRACKING_DEADBAND "TrackingDeadband"
+#define CHILD_KEY_TRACKING_LEAD "TrackingLead"
+#define CHILD_KEY_RAIN_ACTION "RainAction"
+#define CHILD_KEY_RAIN_CLOSE_SHUTTER "RainCloseShutter"
+#define CHILD_KEY_RAIN_SAMPLE_INTERVAL "RainSampleInterval"
+#define CHILD_KEY_RAIN_DEBOUNCE "RainDebounce"
+#define CHILD_KEY_TELEMETRY "Telemetry"
+#define CHILD_KEY_SHUTTER_LINK_BUDGET "ShutterLinkBudget"
 
 #if defined(SB_WIN_BUILD)
 #define DEF_PORT_NAME					"COM1"
@@ -144,6 +157,8 @@ private:
 	TickCountInterface								*	m_pTickCount;
 
     void portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const;
+    void saveGotoTolerance();
+    void applyLogFilter(X2GUIExchangeInterface *uiex);
 
     int         m_nCalibratingError;
 
@@ -157,11 +172,11 @@ private:
     bool        m_bCalibratingDome;
     bool        m_bCalibratingShutter;
     char        m_szLogBuffer[LOG_BUFFER_SIZE];
-    int         m_nBattRequest;
 	int			m_nSavedTicksPerRev;
     int         m_nPanId;
     bool        m_bSettingPanID;
     bool        m_bLogRainStatus;
+    DomeSettings m_ControllerSettings;    // values read from the controller when the settings dialog was filled
 
     CStopWatch  m_SetPanIdTimer;
     CStopWatch  m_DomeCalibrationTimer;